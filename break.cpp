@@ -0,0 +1,205 @@
+#include "break.hpp"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "coreapi.h"
+
+#define XM(X) extern ptr_##X X;
+COREAPI
+#undef XM
+
+#define BUCKET(pc) (((pc) >> 2) & (BREAK_BUCKETS - 1))
+
+breakmanager::breakmanager()
+{
+    for(auto & b : buckets) b = -1;
+}
+
+void breakmanager::attach(bool start_paused)
+{
+    if(!lock) lock = SDL_CreateMutex();
+    context.regs = (const int64_t *) DebugGetCPUDataPtr(M64P_CPU_REG_REG);
+    context.hi = (const int64_t *) DebugGetCPUDataPtr(M64P_CPU_REG_HI);
+    context.lo = (const int64_t *) DebugGetCPUDataPtr(M64P_CPU_REG_LO);
+    context.rdram = (const uint32_t *) DebugMemGetPointer(M64P_DBG_PTR_RDRAM);
+    // the core starts its debugger paused
+    if(start_paused) hold = true;
+    else DebugSetRunState(run_state);
+}
+
+void breakmanager::rehash()
+{
+    for(auto & b : buckets) b = -1;
+    ranged.clear();
+    for(int i = int(points.size()) - 1; i >= 0; i--)
+    {
+        auto & r = points[i].range;
+        if(!(r.flags & M64P_BKP_FLAG_ENABLED)) continue;
+        if((r.flags & M64P_BKP_FLAG_EXEC) and r.address == r.endaddr)
+        {
+            points[i].next = buckets[BUCKET(r.address)];
+            buckets[BUCKET(r.address)] = i;
+        }
+        else
+            ranged.insert(ranged.begin(), i);
+    }
+}
+
+int breakmanager::add(uint32_t start, uint32_t end, unsigned flags, const char * condition)
+{
+    if(!lock) lock = SDL_CreateMutex();
+    breakpoint point;
+    point.range.address = start;
+    point.range.endaddr = end;
+    point.range.flags = flags | M64P_BKP_FLAG_ENABLED;
+    snprintf(point.source, sizeof(point.source), "%s", condition ? condition : "");
+    if(condition and !point.condition.compile(condition))
+        return snprintf(error, sizeof(error), "%s", point.condition.error), -1;
+    if(!condition) point.condition.value = 1;
+    if(points.size() >= BREAKPOINTS_MAX_NUMBER)
+        return snprintf(error, sizeof(error), "too many breakpoints"), -1;
+
+    SDL_LockMutex(lock);
+    int index = DebugBreakpointCommand(M64P_BKP_CMD_ADD_STRUCT, 0, &point.range);
+    if(index != int(points.size()))
+    {
+        // out of step with the core's table; undo rather than guess
+        if(index >= 0) DebugBreakpointCommand(M64P_BKP_CMD_REMOVE_IDX, index, nullptr);
+        SDL_UnlockMutex(lock);
+        return snprintf(error, sizeof(error), "the core refused the breakpoint"), -1;
+    }
+    points.push_back(point);
+    rehash();
+    SDL_UnlockMutex(lock);
+    return index;
+}
+
+bool breakmanager::remove(int index)
+{
+    if(index < 0 or index >= int(points.size())) return false;
+    SDL_LockMutex(lock);
+    DebugBreakpointCommand(M64P_BKP_CMD_REMOVE_IDX, index, nullptr);
+    points.erase(points.begin() + index);
+    rehash();
+    SDL_UnlockMutex(lock);
+    return true;
+}
+
+bool breakmanager::enable(int index, bool on)
+{
+    if(index < 0 or index >= int(points.size())) return false;
+    SDL_LockMutex(lock);
+    DebugBreakpointCommand(on ? M64P_BKP_CMD_ENABLE : M64P_BKP_CMD_DISABLE, index, nullptr);
+    auto & flags = points[index].range.flags;
+    flags = on ? flags | M64P_BKP_FLAG_ENABLED : flags & ~M64P_BKP_FLAG_ENABLED;
+    rehash();
+    SDL_UnlockMutex(lock);
+    return true;
+}
+
+void breakmanager::pause()
+{
+    hold = true;
+    DebugSetRunState(M64P_DBG_RUNSTATE_PAUSED);
+}
+
+void breakmanager::step()
+{
+    if(!stopped) return pause();
+    // still paused, so the core stops again after one instruction
+    stopped = false;
+    DebugStep();
+}
+
+void breakmanager::resume()
+{
+    hold = false;
+    if(!stopped) return (void)DebugSetRunState(run_state);
+    stopped = false;
+    DebugSetRunState(run_state);
+    DebugStep();
+}
+
+bool breakmanager::update(uint32_t pc)
+{
+    stop_pc = pc;
+    if(hold)
+    {
+        stop_index = -1;
+        stopped = true;
+        return true;
+    }
+
+    int hit = -1;
+    bool found = false;
+    SDL_LockMutex(lock);
+    context.pc = pc;
+    for(int i = buckets[BUCKET(pc)]; i >= 0 and hit < 0; i = points[i].next)
+    {
+        auto & point = points[i];
+        if(point.range.address != pc) continue;
+        found = true;
+        point.checks++;
+        if(point.condition.eval(context)) hit = i;
+    }
+    // A data breakpoint doesn't tell which one fired, so the stop counts as any of them whose
+    // condition holds. Execute ranges are rare enough to check here as well.
+    if(!found)
+        for(size_t j = 0; j < ranged.size() and hit < 0; j++)
+        {
+            auto & point = points[ranged[j]];
+            auto & r = point.range;
+            if((r.flags & M64P_BKP_FLAG_EXEC) and (pc < r.address or pc > r.endaddr)) continue;
+            point.checks++;
+            if(point.condition.eval(context)) hit = ranged[j];
+        }
+    if(hit >= 0) points[hit].hits++;
+    SDL_UnlockMutex(lock);
+
+    if(hit < 0)
+    {
+        // setting the state before returning keeps the core from waiting at all
+        resumed++;
+        DebugSetRunState(run_state);
+        return false;
+    }
+    stop_index = hit;
+    hold = true;
+    stopped = true;
+    return true;
+}
+
+int breakmanager::match(uint32_t pc)
+{
+    int hit = -1;
+    SDL_LockMutex(lock);
+    context.pc = pc;
+    for(int i = buckets[BUCKET(pc)]; i >= 0 and hit < 0; i = points[i].next)
+        if(points[i].range.address == pc and points[i].condition.eval(context)) hit = i;
+    for(size_t j = 0; j < ranged.size() and hit < 0; j++)
+    {
+        auto & r = points[ranged[j]].range;
+        if((r.flags & M64P_BKP_FLAG_EXEC) and pc >= r.address and pc <= r.endaddr and points[ranged[j]].condition.eval(context))
+            hit = ranged[j];
+    }
+    SDL_UnlockMutex(lock);
+    return hit;
+}
+
+void breakmanager::replay()
+{
+    if(!stopped) return;
+    stopped = false;
+    DebugSetRunState(M64P_DBG_RUNSTATE_STEPPING);
+    DebugStep();
+}
+
+void breakmanager::park(uint32_t pc)
+{
+    stop_pc = pc;
+    stop_index = -1;
+    hold = true;
+    stopped = true;
+    DebugSetRunState(M64P_DBG_RUNSTATE_PAUSED);
+}
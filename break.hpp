@@ -0,0 +1,65 @@
+#include <stdint.h>
+#include <vector>
+#include <atomic>
+
+#include <SDL2/SDL.h>
+
+#include "include/m64p_types.h"
+#include "expr.hpp"
+
+// execute breakpoints on a single address are found through a hash of the PC
+#define BREAK_BUCKETS 256
+
+struct breakpoint {
+    m64p_breakpoint range; // as handed to the core
+    expression condition; // constant 1 when there is none
+    char source[96]; // condition as typed
+    uint32_t checks = 0; // stops the condition was evaluated for
+    uint32_t hits = 0; // stops the condition held for
+    int next = -1; // next breakpoint in the same bucket
+};
+
+// Conditional breakpoints on top of the core's debugger.
+// The core pauses and calls the update callback whenever any breakpoint in its table is reached.
+// update() runs there, on the emulation thread: it finds the breakpoints for the PC, evaluates their
+// precompiled conditions and, when none holds, sets the core running again before it ever waits,
+// so a hot breakpoint with a false condition costs a hash lookup and a few bytecode steps.
+// points is kept in the same order as the core's table, so an index means the same breakpoint to both.
+struct breakmanager {
+    std::vector<breakpoint> points;
+    int buckets[BREAK_BUCKETS];
+    std::vector<int> ranged; // data breakpoints and execute ranges, checked by scanning
+    SDL_mutex * lock = nullptr;
+    exprcontext context;
+
+    // The user paused or a condition held: stops are reported instead of resumed.
+    std::atomic<bool> hold{false};
+    std::atomic<bool> stopped{false}; // emulation is parked in the core's debugger
+    uint32_t stop_pc = 0;
+    int stop_index = -1; // breakpoint that stopped emulation, or -1 for a pause or step
+    uint64_t resumed = 0; // stops continued because no condition held
+    char error[64] = "";
+    // what emulation goes back to when it continues: running, or stepping while instructions are traced
+    m64p_dbg_runstate run_state = M64P_DBG_RUNSTATE_RUNNING;
+    
+    breakmanager();
+    // debugger init callback: picks up CPU state and lets emulation run
+    void attach(bool start_paused);
+    // index of the new breakpoint, or -1 with error describing why
+    int add(uint32_t start, uint32_t end, unsigned flags, const char * condition);
+    bool remove(int index);
+    bool enable(int index, bool on);
+    void pause();
+    void step();
+    void resume();
+    // update callback; true if emulation stays paused
+    bool update(uint32_t pc);
+    // an execute breakpoint at pc whose condition holds now, or -1; counts nothing
+    int match(uint32_t pc);
+    // stopped core: lets it step on while hold stays set, for a reverse replay that parks it again
+    void replay();
+    // update callback: stops emulation at pc on behalf of something other than a breakpoint
+    void park(uint32_t pc);
+    // rebuilds buckets and ranged from points; lock held
+    void rehash();
+};
@@ -0,0 +1,151 @@
+#include "callstack.hpp"
+#include "rdram.hpp"
+
+#include "coreapi.h"
+
+#define XM(X) extern ptr_##X X;
+COREAPI
+#undef XM
+
+#define OPCODE(w) ((w) >> 26)
+#define RS(w) (((w) >> 21) & 31)
+#define FUNCT(w) ((w) & 63)
+#define OP_SPECIAL 0
+#define OP_JAL 3
+#define FUNCT_JR 8
+#define FUNCT_JALR 9
+#define RA 31
+
+void callstack::attach()
+{
+    regs = (const int64_t *) DebugGetCPUDataPtr(M64P_CPU_REG_REG);
+    rdram = (const uint32_t *) DebugMemGetPointer(M64P_DBG_PTR_RDRAM);
+}
+
+// slot for entry, claimed if new; -1 once the table is full
+int callstack::function(uint32_t entry)
+{
+    uint32_t i = (entry >> 2) * 2654435761u;
+    for(int probes = 0; probes < CALLSTACK_FUNCTIONS; probes++, i++)
+    {
+        auto & f = functions[i & (CALLSTACK_FUNCTIONS-1)];
+        uint32_t e = f.entry.load(std::memory_order_relaxed);
+        if(e == entry) return i & (CALLSTACK_FUNCTIONS-1);
+        if(e == 0)
+        {
+            f.entry.store(entry, std::memory_order_relaxed);
+            function_count.store(function_count + 1, std::memory_order_relaxed);
+            return i & (CALLSTACK_FUNCTIONS-1);
+        }
+    }
+    return -1;
+}
+
+void callstack::push(uint32_t entry, uint32_t ret)
+{
+    uint32_t d = depth.load(std::memory_order_relaxed);
+    if(d == CALLSTACK_DEPTH)
+    {
+        lost++;
+        return;
+    }
+    version.fetch_add(1, std::memory_order_acq_rel);
+    auto & frame = frames[d];
+    frame.entry = entry;
+    frame.ret = ret;
+    frame.start = steps.load(std::memory_order_relaxed);
+    frame.function = function(entry);
+    frame.outermost = frame.function < 0 or functions[frame.function].active++ == 0;
+    depth.store(d + 1, std::memory_order_relaxed);
+    version.fetch_add(1, std::memory_order_release);
+}
+
+void callstack::pop()
+{
+    uint32_t d = depth.load(std::memory_order_relaxed);
+    if(d == 0) return;
+    version.fetch_add(1, std::memory_order_acq_rel);
+    auto & frame = frames[d - 1];
+    if(frame.function >= 0)
+    {
+        auto & f = functions[frame.function];
+        f.calls.store(f.calls + 1, std::memory_order_relaxed);
+        if(frame.outermost)
+            f.inclusive.store(f.inclusive + steps.load(std::memory_order_relaxed) - frame.start, std::memory_order_relaxed);
+        f.active--;
+    }
+    depth.store(d - 1, std::memory_order_relaxed);
+    version.fetch_add(1, std::memory_order_release);
+}
+
+void callstack::clear()
+{
+    version.fetch_add(1, std::memory_order_acq_rel);
+    depth.store(0, std::memory_order_relaxed);
+    lost = 0;
+    for(auto & f : functions)
+    {
+        f.entry.store(0, std::memory_order_relaxed);
+        f.calls.store(0, std::memory_order_relaxed);
+        f.inclusive.store(0, std::memory_order_relaxed);
+        f.self.store(0, std::memory_order_relaxed);
+        f.active = 0;
+    }
+    function_count.store(0, std::memory_order_relaxed);
+    steps.store(0, std::memory_order_relaxed);
+    outside.store(0, std::memory_order_relaxed);
+    version.fetch_add(1, std::memory_order_release);
+}
+
+void callstack::step(uint32_t pc)
+{
+    if(reset_requested.exchange(false)) clear();
+    steps.store(steps + 1, std::memory_order_relaxed);
+
+    uint32_t d = depth.load(std::memory_order_relaxed);
+    if(d and !lost and pc == frames[d-1].ret)
+    {
+        pop();
+        d--;
+    }
+    if(d == 0) outside.store(outside + 1, std::memory_order_relaxed);
+    else if(frames[d-1].function >= 0)
+    {
+        auto & f = functions[frames[d-1].function];
+        f.self.store(f.self + 1, std::memory_order_relaxed);
+    }
+
+    uint32_t phys = rdram_phys(pc);
+    uint32_t word = rdram and phys != UINT32_MAX ? rdram[phys >> 2] : DebugMemRead32(pc);
+    if(OPCODE(word) == OP_JAL)
+        push(((pc + 4) & 0xF0000000) | (word & 0x03FFFFFF) << 2, pc + 8);
+    else if(OPCODE(word) == OP_SPECIAL and FUNCT(word) == FUNCT_JALR and regs)
+        push(uint32_t(regs[RS(word)]), pc + 8);
+    else if(OPCODE(word) == OP_SPECIAL and FUNCT(word) == FUNCT_JR and RS(word) == RA and regs)
+    {
+        // returns past calls that went untracked first; then to the newest frame expecting ra, if any
+        if(lost) return (void)lost--;
+        uint32_t ra = uint32_t(regs[RA]);
+        for(uint32_t i = d; i > 0; i--)
+            if(frames[i-1].ret == ra)
+            {
+                while(depth.load(std::memory_order_relaxed) >= i) pop();
+                break;
+            }
+    }
+}
+
+int callstack::backtrace(callframe * out, int max)
+{
+    for(int tries = 0; tries < 16; tries++)
+    {
+        uint32_t v = version.load(std::memory_order_acquire);
+        if(v & 1) continue;
+        int n = depth.load(std::memory_order_relaxed);
+        if(n > max) n = max;
+        for(int i = 0; i < n; i++) out[i] = frames[i];
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(version.load(std::memory_order_relaxed) == v) return n;
+    }
+    return 0;
+}
@@ -0,0 +1,56 @@
+#include <stdint.h>
+#include <atomic>
+
+// deepest call chain followed; calls past it are counted, not recorded
+#define CALLSTACK_DEPTH 256
+// functions the profile keeps apart; a power of two
+#define CALLSTACK_FUNCTIONS 4096
+
+struct callframe {
+    uint32_t entry; // the called address
+    uint32_t ret; // where the call returns to
+    uint64_t start; // steps when the call was made
+    int function; // slot in functions, or -1 when the table is full
+    bool outermost; // no older call of the same function is on the stack
+};
+
+struct callfunction {
+    std::atomic<uint32_t> entry{0}; // 0 for a free slot
+    std::atomic<uint64_t> calls{0}; // returned calls
+    std::atomic<uint64_t> inclusive{0}; // instructions from entry to return, recursion counted once
+    std::atomic<uint64_t> self{0}; // instructions executed while innermost
+    uint32_t active = 0; // frames on the stack
+};
+
+// Shadow call stack, kept from the debugger's per-instruction callback while the core steps.
+// step() fetches the word about to execute: jal and jalr push a frame, jr ra unwinds to the frame
+// returning to ra, and reaching the top frame's return address pops it, which also catches returns
+// through other registers. The stack and the per-function table are fixed arrays, so stepping never
+// allocates. The emulation thread is the only writer; the UI copies the stack with backtrace(),
+// which retries while a push or pop is under way, and reads the table's counters directly.
+struct callstack {
+    callframe frames[CALLSTACK_DEPTH];
+    std::atomic<uint32_t> depth{0};
+    std::atomic<uint32_t> version{0}; // odd while frames change
+    uint32_t lost = 0; // calls made past CALLSTACK_DEPTH and not returned yet
+    callfunction functions[CALLSTACK_FUNCTIONS];
+    std::atomic<uint32_t> function_count{0};
+    std::atomic<uint64_t> steps{0};
+    std::atomic<uint64_t> outside{0}; // instructions run with an empty stack
+
+    std::atomic<bool> enabled{false};
+    std::atomic<bool> reset_requested{false}; // applied by the next step
+    const int64_t * regs = nullptr;
+    const uint32_t * rdram = nullptr;
+
+    // debugger init callback: picks up CPU state
+    void attach();
+    void step(uint32_t pc);
+    // copies up to max frames, outermost first; returns how many
+    int backtrace(callframe * out, int max);
+
+    int function(uint32_t entry);
+    void push(uint32_t entry, uint32_t ret);
+    void pop();
+    void clear();
+};
@@ -0,0 +1,228 @@
+#include "column.hpp"
+
+#include <string.h>
+#include <algorithm>
+
+#include <zlib.h>
+
+static const char header_magic[] = "BACREC01";
+static const char footer_magic[] = "BACIDX01";
+#define FOOTER_SIZE 20
+
+static void put32(std::vector<uint8_t> & out, uint32_t v)
+{
+    for(int i = 0; i < 4; i++) out.push_back(v >> 8*i);
+}
+
+static void put64(std::vector<uint8_t> & out, uint64_t v)
+{
+    for(int i = 0; i < 8; i++) out.push_back(v >> 8*i);
+}
+
+static uint32_t get32(const uint8_t * p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | uint32_t(p[3]) << 24;
+}
+
+static uint64_t get64(const uint8_t * p)
+{
+    return get32(p) | uint64_t(get32(p+4)) << 32;
+}
+
+bool column_pack(const uint32_t * values, uint32_t rows, uint32_t encoding, int level, std::vector<uint8_t> & out)
+{
+    std::vector<uint8_t> planes(size_t(rows)*4);
+    uint32_t previous = 0;
+    for(uint32_t i = 0; i < rows; i++)
+    {
+        uint32_t v = values[i], t;
+        if(encoding == COLUMN_XOR)
+            t = v ^ previous;
+        else
+        {
+            int32_t d = int32_t(v - previous);
+            t = uint32_t(d) << 1 ^ uint32_t(d >> 31);
+        }
+        previous = v;
+        for(int p = 0; p < 4; p++)
+            planes[size_t(p)*rows + i] = t >> 8*p;
+    }
+    uLongf size = compressBound(planes.size());
+    size_t at = out.size();
+    out.resize(at + size);
+    if(compress2(out.data() + at, &size, planes.data(), planes.size(), level) != Z_OK) return false;
+    out.resize(at + size);
+    return true;
+}
+
+bool column_unpack(const uint8_t * data, size_t size, uint32_t rows, uint32_t encoding, uint32_t * values)
+{
+    std::vector<uint8_t> planes(size_t(rows)*4);
+    uLongf got = planes.size();
+    if(uncompress(planes.data(), &got, data, size) != Z_OK or got != planes.size()) return false;
+    uint32_t previous = 0;
+    for(uint32_t i = 0; i < rows; i++)
+    {
+        uint32_t t = 0;
+        for(int p = 0; p < 4; p++)
+            t |= uint32_t(planes[size_t(p)*rows + i]) << 8*p;
+        if(encoding == COLUMN_XOR)
+            previous ^= t;
+        else
+            previous += uint32_t(int32_t(t >> 1) ^ -int32_t(t & 1));
+        values[i] = previous;
+    }
+    return true;
+}
+
+bool columnwriter::open(const char * path, const std::vector<columninfo> & columns)
+{
+    file = fopen(path, "wb");
+    if(!file) return false;
+    this->columns = columns;
+    index.clear();
+    raw_bytes = 0;
+    std::vector<uint8_t> header(header_magic, header_magic + 8);
+    put32(header, columns.size());
+    for(auto & c : columns)
+    {
+        put32(header, c.encoding);
+        header.push_back(c.name.size());
+        header.push_back(c.name.size() >> 8);
+        header.insert(header.end(), c.name.begin(), c.name.end());
+    }
+    offset = fwrite(header.data(), 1, header.size(), file);
+    return offset == header.size();
+}
+
+bool columnwriter::write(uint32_t rows, const uint32_t * values, uint32_t stride, int level)
+{
+    if(!file or rows == 0) return false;
+    std::vector<uint8_t> block, packed;
+    std::vector<uint32_t> sizes;
+    for(size_t c = 0; c < columns.size(); c++)
+    {
+        size_t before = packed.size();
+        if(!column_pack(values + c*stride, rows, columns[c].encoding, level, packed)) return false;
+        sizes.push_back(packed.size() - before);
+    }
+    columnblock entry = {offset, values[0], values[rows-1], rows};
+    put32(block, COLUMN_BLOCK);
+    put32(block, entry.first);
+    put32(block, entry.last);
+    put32(block, rows);
+    for(auto s : sizes) put32(block, s);
+    block.insert(block.end(), packed.begin(), packed.end());
+    if(fwrite(block.data(), 1, block.size(), file) != block.size()) return false;
+    // a reader can rebuild the index from block headers, so the file is usable even if we never get to close()
+    fflush(file);
+    offset += block.size();
+    raw_bytes += uint64_t(rows) * columns.size() * 4;
+    index.push_back(entry);
+    return true;
+}
+
+void columnwriter::close()
+{
+    if(!file) return;
+    std::vector<uint8_t> tail;
+    for(auto & b : index)
+    {
+        put64(tail, b.offset);
+        put32(tail, b.first);
+        put32(tail, b.last);
+        put32(tail, b.rows);
+    }
+    put64(tail, offset);
+    put32(tail, index.size());
+    tail.insert(tail.end(), footer_magic, footer_magic + 8);
+    fwrite(tail.data(), 1, tail.size(), file);
+    fclose(file);
+    file = nullptr;
+}
+
+bool columnreader::open(const char * path)
+{
+    file = fopen(path, "rb");
+    if(!file) return false;
+    uint8_t buf[12];
+    if(fread(buf, 1, 12, file) != 12 or memcmp(buf, header_magic, 8) != 0) return close(), false;
+    columns.resize(get32(buf+8));
+    for(auto & c : columns)
+    {
+        uint8_t info[6];
+        if(fread(info, 1, 6, file) != 6) return close(), false;
+        c.encoding = get32(info);
+        c.name.resize(info[4] | info[5] << 8);
+        if(fread(&c.name[0], 1, c.name.size(), file) != c.name.size()) return close(), false;
+    }
+    uint64_t data_start = ftell(file);
+
+    // the footer's index, when the writer finished
+    index.clear();
+    uint8_t footer[FOOTER_SIZE];
+    if(fseek(file, -FOOTER_SIZE, SEEK_END) == 0 and fread(footer, 1, FOOTER_SIZE, file) == FOOTER_SIZE
+       and memcmp(footer+12, footer_magic, 8) == 0)
+    {
+        uint64_t at = get64(footer);
+        uint32_t blocks = get32(footer+8);
+        std::vector<uint8_t> raw(size_t(blocks)*20);
+        fseek(file, at, SEEK_SET);
+        if(fread(raw.data(), 1, raw.size(), file) == raw.size())
+        {
+            for(uint32_t i = 0; i < blocks; i++)
+            {
+                auto p = &raw[size_t(i)*20];
+                index.push_back({get64(p), get32(p+8), get32(p+12), get32(p+16)});
+            }
+            return true;
+        }
+    }
+
+    // otherwise walk the block headers
+    uint64_t at = data_start;
+    std::vector<uint8_t> head(16 + columns.size()*4);
+    while(fseek(file, at, SEEK_SET) == 0 and fread(head.data(), 1, head.size(), file) == head.size())
+    {
+        if(get32(head.data()) != COLUMN_BLOCK) break;
+        uint64_t size = head.size();
+        for(size_t c = 0; c < columns.size(); c++)
+            size += get32(&head[16 + c*4]);
+        index.push_back({at, get32(&head[4]), get32(&head[8]), get32(&head[12])});
+        at += size;
+    }
+    // the last block may have been cut off mid-write
+    if(!index.empty())
+    {
+        fseek(file, 0, SEEK_END);
+        if(uint64_t(ftell(file)) < at) index.pop_back();
+    }
+    return true;
+}
+
+size_t columnreader::find(uint32_t frame)
+{
+    return std::partition_point(index.begin(), index.end(), [&](const columnblock & b) { return b.last < frame; }) - index.begin();
+}
+
+bool columnreader::read(size_t block, uint32_t column, std::vector<uint32_t> & out)
+{
+    if(block >= index.size() or column >= columns.size()) return false;
+    auto & b = index[block];
+    std::vector<uint8_t> head(16 + columns.size()*4);
+    if(fseek(file, b.offset, SEEK_SET) != 0 or fread(head.data(), 1, head.size(), file) != head.size()) return false;
+    uint64_t skip = 0;
+    for(uint32_t c = 0; c < column; c++)
+        skip += get32(&head[16 + c*4]);
+    std::vector<uint8_t> packed(get32(&head[16 + column*4]));
+    if(fseek(file, b.offset + head.size() + skip, SEEK_SET) != 0) return false;
+    if(fread(packed.data(), 1, packed.size(), file) != packed.size()) return false;
+    out.resize(b.rows);
+    return column_unpack(packed.data(), packed.size(), b.rows, columns[column].encoding, out.data());
+}
+
+void columnreader::close()
+{
+    if(file) fclose(file);
+    file = nullptr;
+}
@@ -0,0 +1,67 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+#include <string>
+
+// Columnar per-frame recording file.
+//   header: "BACREC01", u32 column count, per column: u32 encoding, u16 name length, name
+//   blocks: u32 COLUMN_BLOCK, u32 first frame, u32 last frame, u32 rows, u32 packed size per column,
+//           then the packed columns back to back
+//   index:  per block: u64 file offset, u32 first frame, u32 last frame, u32 rows
+//   footer: u64 index offset, u32 block count, "BACIDX01"
+// All integers are little-endian. Column 0 is always the frame number.
+// A packed column is the values delta (zigzag) or XOR coded against the previous row, split into
+// four byte planes and deflated; slow-moving values turn into long runs of zero bytes. Columns are
+// packed separately so a reader inflates only the columns it asks for, and the index lets it seek
+// straight to the blocks covering a frame range. A file whose writer died has no index; readers
+// rebuild it by walking the block headers.
+
+#define COLUMN_BLOCK 0x314B4C42 // "BLK1"
+
+enum {
+    COLUMN_DELTA, // integers: small changes become small numbers
+    COLUMN_XOR // floats: unchanged sign/exponent bits become zeros
+};
+
+struct columninfo {
+    uint32_t encoding;
+    std::string name;
+};
+
+struct columnblock {
+    uint64_t offset;
+    uint32_t first; // frame numbers covered
+    uint32_t last;
+    uint32_t rows;
+};
+
+// appends the packed form of rows values; false if zlib fails
+bool column_pack(const uint32_t * values, uint32_t rows, uint32_t encoding, int level, std::vector<uint8_t> & out);
+bool column_unpack(const uint8_t * data, size_t size, uint32_t rows, uint32_t encoding, uint32_t * values);
+
+struct columnwriter {
+    FILE * file = nullptr;
+    std::vector<columninfo> columns;
+    std::vector<columnblock> index;
+    uint64_t offset = 0;
+    uint64_t raw_bytes = 0; // values handed in, for the compression ratio
+
+    bool open(const char * path, const std::vector<columninfo> & columns);
+    // values are column-major: column c's rows start at values + c*stride
+    bool write(uint32_t rows, const uint32_t * values, uint32_t stride, int level);
+    // writes the index and footer
+    void close();
+};
+
+struct columnreader {
+    FILE * file = nullptr;
+    std::vector<columninfo> columns;
+    std::vector<columnblock> index;
+
+    bool open(const char * path);
+    // first block whose last frame is at or after frame; index.size() if none
+    size_t find(uint32_t frame);
+    // inflates one column of one block
+    bool read(size_t block, uint32_t column, std::vector<uint32_t> & out);
+    void close();
+};
@@ -1 +1,4 @@
-g++ fork.cpp deconf.cpp -lSDL2 -Wl,-rpath=plugin -ggdb -lcurses
+g++ fork.cpp deconf.cpp rom.cpp romid.cpp watch.cpp log.cpp screen.cpp wake.cpp scan.cpp heat.cpp expr.cpp break.cpp column.cpp record.cpp spark.cpp disasm.cpp profile.cpp tracefile.cpp trace.cpp coverage.cpp callstack.cpp reverse.cpp rewind.cpp statefile.cpp -lSDL2 -Wl,-rpath=plugin -ggdb -lcurses -lz
+g++ recquery.cpp column.cpp -ggdb -lz -o recquery
+g++ tracequery.cpp tracefile.cpp -ggdb -lz -o tracequery
+g++ swapbench.cpp rom.cpp -O2 -ggdb -lSDL2 -lz -o swapbench
@@ -12,10 +12,16 @@ XM(CoreDoCommand)\
 XM(CoreErrorMessage)\
 \
 XM(ConfigSaveFile)\
+XM(ConfigOpenSection)\
+XM(ConfigSetParameter)\
+XM(ConfigGetParamInt)\
 \
 XM(DebugSetCallbacks)\
 XM(DebugSetRunState)\
 XM(DebugGetState)\
 XM(DebugStep)\
 XM(DebugMemGetPointer)\
-XM(DebugMemRead32)
+XM(DebugMemRead32)\
+XM(DebugGetCPUDataPtr)\
+XM(DebugBreakpointCommand)\
+XM(DebugDecodeOp)
@@ -0,0 +1,171 @@
+#include "coverage.hpp"
+#include "rdram.hpp"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <zlib.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define COVERAGE_X86
+#endif
+
+static const char magic[] = "BACCOV01";
+#define HEADER_SIZE 16
+
+coverageset::coverageset()
+{
+    bits.assign(COVERAGE_WORDS, 0);
+}
+
+uint64_t coverageset::count() const
+{
+    uint64_t n = 0;
+    for(auto w : bits) n += __builtin_popcountll(w);
+    return n;
+}
+
+bool coverageset::save(const char * path) const
+{
+    std::vector<uint8_t> raw(bits.size() * 8);
+    for(size_t w = 0; w < bits.size(); w++)
+        for(int i = 0; i < 8; i++)
+            raw[w*8 + i] = bits[w] >> 8*i;
+    uLongf size = compressBound(raw.size());
+    std::vector<uint8_t> out(HEADER_SIZE + size);
+    if(compress2(out.data() + HEADER_SIZE, &size, raw.data(), raw.size(), 6) != Z_OK) return false;
+    memcpy(out.data(), magic, 8);
+    for(int i = 0; i < 4; i++)
+    {
+        out[8 + i] = uint32_t(bits.size()) >> 8*i;
+        out[12 + i] = uint32_t(size) >> 8*i;
+    }
+    out.resize(HEADER_SIZE + size);
+    FILE * f = fopen(path, "wb");
+    if(!f) return false;
+    bool ok = fwrite(out.data(), 1, out.size(), f) == out.size();
+    return fclose(f) == 0 and ok;
+}
+
+bool coverageset::load(const char * path)
+{
+    FILE * f = fopen(path, "rb");
+    if(!f) return false;
+    uint8_t head[HEADER_SIZE];
+    std::vector<uint8_t> packed;
+    bool ok = fread(head, 1, HEADER_SIZE, f) == HEADER_SIZE and memcmp(head, magic, 8) == 0;
+    uint32_t words = 0, size = 0;
+    for(int i = 0; i < 4; i++)
+    {
+        words |= uint32_t(head[8 + i]) << 8*i;
+        size |= uint32_t(head[12 + i]) << 8*i;
+    }
+    if(ok)
+    {
+        packed.resize(size);
+        ok = words == COVERAGE_WORDS and fread(packed.data(), 1, size, f) == size;
+    }
+    fclose(f);
+    if(!ok) return false;
+    std::vector<uint8_t> raw(size_t(words) * 8);
+    uLongf got = raw.size();
+    if(uncompress(raw.data(), &got, packed.data(), packed.size()) != Z_OK or got != raw.size()) return false;
+    for(size_t w = 0; w < bits.size(); w++)
+    {
+        uint64_t v = 0;
+        for(int i = 0; i < 8; i++) v |= uint64_t(raw[w*8 + i]) << 8*i;
+        bits[w] = v;
+    }
+    return true;
+}
+
+static void combine_scalar(const uint64_t * a, const uint64_t * b, int op, uint64_t * out, size_t words)
+{
+    for(size_t i = 0; i < words; i++)
+        out[i] = op == COVER_UNION ? a[i] | b[i] : op == COVER_INTERSECT ? a[i] & b[i] : a[i] & ~b[i];
+}
+
+#ifdef COVERAGE_X86
+__attribute__((target("avx2")))
+static void combine_avx2(const uint64_t * a, const uint64_t * b, int op, uint64_t * out, size_t words)
+{
+    size_t i = 0;
+    for(; i + 4 <= words; i += 4)
+    {
+        auto x = _mm256_loadu_si256((const __m256i *)(a + i));
+        auto y = _mm256_loadu_si256((const __m256i *)(b + i));
+        // andnot complements its first operand
+        auto r = op == COVER_UNION ? _mm256_or_si256(x, y) : op == COVER_INTERSECT ? _mm256_and_si256(x, y) : _mm256_andnot_si256(y, x);
+        _mm256_storeu_si256((__m256i *)(out + i), r);
+    }
+    combine_scalar(a + i, b + i, op, out + i, words - i);
+}
+#endif //  COVERAGE_X86
+
+void coverage_combine(const coverageset & a, const coverageset & b, int op, coverageset & out)
+{
+    #ifdef COVERAGE_X86
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    auto combine = avx2 ? combine_avx2 : combine_scalar;
+    #else  //  COVERAGE_X86
+    auto combine = combine_scalar;
+    #endif //  COVERAGE_X86
+    out.bits.resize(COVERAGE_WORDS);
+    combine(a.bits.data(), b.bits.data(), op, out.bits.data(), COVERAGE_WORDS);
+}
+
+void coverage_ranges(const coverageset & set, std::vector<coveragerange> & out)
+{
+    out.clear();
+    for(uint32_t w = 0; w < set.bits.size(); w++)
+    {
+        uint64_t v = set.bits[w];
+        while(v)
+        {
+            // one run of set bits at a time: its start, then the first clear bit after it
+            uint32_t start = __builtin_ctzll(v);
+            uint64_t rest = ~v >> start;
+            uint32_t len = rest ? __builtin_ctzll(rest) : 64 - start;
+            uint32_t word = w*64 + start;
+            if(!out.empty() and out.back().addr + out.back().words*4 == 0x80000000 + word*4)
+                out.back().words += len;
+            else
+                out.push_back({0x80000000 + word*4, len});
+            v = start + len < 64 ? v & ~uint64_t(0) << (start + len) : 0;
+        }
+    }
+}
+
+coverage::coverage() : bits(COVERAGE_WORDS)
+{
+    reset();
+}
+
+void coverage::mark(uint32_t pc)
+{
+    uint32_t phys = rdram_phys(pc);
+    if(phys == UINT32_MAX) return;
+    auto & w = bits[phys >> 8];
+    uint64_t bit = uint64_t(1) << ((phys >> 2) & 63);
+    if(!(w.load(std::memory_order_relaxed) & bit)) w.fetch_or(bit, std::memory_order_relaxed);
+}
+
+void coverage::reset()
+{
+    for(auto & w : bits) w.store(0, std::memory_order_relaxed);
+}
+
+uint64_t coverage::count()
+{
+    uint64_t n = 0;
+    for(auto & w : bits) n += __builtin_popcountll(w.load(std::memory_order_relaxed));
+    return n;
+}
+
+void coverage::snapshot(coverageset & out)
+{
+    out.bits.resize(COVERAGE_WORDS);
+    for(size_t i = 0; i < bits.size(); i++)
+        out.bits[i] = bits[i].load(std::memory_order_relaxed);
+}
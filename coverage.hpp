@@ -0,0 +1,51 @@
+#include <stdint.h>
+#include <vector>
+#include <atomic>
+
+// one bit per word of the 8 MiB of RDRAM
+#define COVERAGE_BITS (0x800000/4)
+#define COVERAGE_WORDS (COVERAGE_BITS/64)
+
+enum {
+    COVER_UNION, // covered by either run
+    COVER_INTERSECT, // covered by both
+    COVER_DIFFERENCE // covered by the first run only
+};
+
+// A saved coverage bitmap: bit i of bits[w] is set if the instruction at physical RDRAM word 64*w+i
+// was seen executing. Files are "BACCOV01", u32 word count, u32 packed size, then the words
+// little-endian and deflated; runs cover little of RDRAM, so they pack to a few KB.
+struct coverageset {
+    std::vector<uint64_t> bits;
+
+    coverageset();
+    uint64_t count() const; // covered words
+    bool save(const char * path) const;
+    bool load(const char * path);
+};
+
+// out = a op b, 256 bits at a time where the CPU has AVX2; out may be a or b
+void coverage_combine(const coverageset & a, const coverageset & b, int op, coverageset & out);
+
+struct coveragerange {
+    uint32_t addr; // KSEG0 address of the first word
+    uint32_t words;
+};
+
+// the set's covered words as runs of consecutive words, lowest first
+void coverage_ranges(const coverageset & set, std::vector<coveragerange> & out);
+
+// Coverage of the running game. mark() may be called from the emulation thread (per instruction while
+// the core steps) and the profiler thread (per sample) at once, so bits are atomics; a bit that is
+// already set, the usual case in a loop, costs a load and no write.
+struct coverage {
+    std::vector<std::atomic<uint64_t>> bits;
+    std::atomic<bool> stepping{false}; // the core steps so that every instruction is marked
+    std::atomic<bool> sampling{false}; // profiler samples are marked
+
+    coverage();
+    void mark(uint32_t pc);
+    void reset();
+    void snapshot(coverageset & out);
+    uint64_t count(); // covered words, without copying the bitmap
+};
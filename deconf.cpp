@@ -145,6 +145,13 @@ void deconf::make_string(const char * key, const char * value)
     list[string(key)] = confval({TEXT, string(value), 0});
 }
 
+float deconf::get_real(const char * key, float fallback)
+{
+    auto found = list.find(string(key));
+    if(found == list.end() or found->second.text.buffer) return fallback;
+    return found->second.real;
+}
+
 deconf deconf_load(const char * filename)
 {
     deconf data;
@@ -41,6 +41,8 @@ struct deconf {
     bool is_string(const char * key);
     char * get_string(const char * key);
     void make_string(const char * key, const char * value);
+    // numeric value, or fallback if the key is missing or not a number
+    float get_real(const char * key, float fallback);
 };
 
 deconf deconf_load(const char * filename);
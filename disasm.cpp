@@ -0,0 +1,44 @@
+#include "disasm.hpp"
+#include "rdram.hpp"
+
+#include <stdio.h>
+
+#include "coreapi.h"
+
+#define XM(X) extern ptr_##X X;
+COREAPI
+#undef XM
+
+disasmcache::disasmcache()
+{
+    // address 1 is never an instruction, so every slot starts out missing
+    slots.assign(DISASM_SLOTS, disasmline{1, 0, "", ""});
+}
+
+uint32_t disasmcache::fetch(const uint32_t * rdram, uint32_t addr)
+{
+    uint32_t phys = rdram_phys(addr);
+    if(rdram and phys != UINT32_MAX) return rdram[phys >> 2];
+    return DebugMemRead32(addr);
+}
+
+const disasmline & disasmcache::decode(const uint32_t * rdram, uint32_t addr)
+{
+    addr &= ~3u;
+    uint32_t word = fetch(rdram, addr);
+    auto & line = slots[(addr >> 2) & (DISASM_SLOTS-1)];
+    if(line.addr == addr and line.word == word)
+    {
+        hits++;
+        return line;
+    }
+    misses++;
+    // the core writes into whatever it's given; decode into roomy buffers and keep the start
+    char op[64] = "", args[64] = "";
+    DebugDecodeOp(word, op, args, addr);
+    line.addr = addr;
+    line.word = word;
+    snprintf(line.op, sizeof(line.op), "%.*s", int(sizeof(line.op) - 1), op);
+    snprintf(line.args, sizeof(line.args), "%.*s", int(sizeof(line.args) - 1), args);
+    return line;
+}
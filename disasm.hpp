@@ -0,0 +1,27 @@
+#include <stdint.h>
+#include <vector>
+
+// slots in the decoded-instruction cache; a power of two, 64 bytes each
+#define DISASM_SLOTS 16384
+
+struct disasmline {
+    uint32_t addr;
+    uint32_t word;
+    char op[12];
+    char args[44];
+};
+
+// Direct-mapped cache of DebugDecodeOp output, indexed by address and tagged with the address and the
+// instruction word it was decoded from. A lookup re-reads the word (one RDRAM load) and only goes to
+// the core's decoder when the slot holds another address or the code there has changed, so
+// scrolling back and forth over unchanged code decodes each instruction once.
+struct disasmcache {
+    std::vector<disasmline> slots;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+
+    disasmcache();
+    // word currently at addr; RDRAM directly, anything else through the core
+    uint32_t fetch(const uint32_t * rdram, uint32_t addr);
+    const disasmline & decode(const uint32_t * rdram, uint32_t addr);
+};
@@ -0,0 +1,375 @@
+#include "expr.hpp"
+#include "rdram.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "coreapi.h"
+
+#define XM(X) extern ptr_##X X;
+COREAPI
+#undef XM
+
+// Each instruction is one word: opcode in the low 7 bits, a small operand (register number, jump
+// target) above bit 8. IMM and binary ops flagged X_IMMEDIATE take their value from the next word.
+enum {
+    X_IMM,
+    X_REG,
+    X_PC,
+    X_HI,
+    X_LO,
+    X_LOAD8,
+    X_LOAD16,
+    X_LOAD32,
+    X_NOT,
+    X_NEG,
+    X_INV,
+    X_BOOL,
+    X_JZ, // &&: leave a zero and jump, otherwise drop it
+    X_JNZ, // ||: replace a nonzero with 1 and jump, otherwise drop it
+    // binary
+    X_ADD,
+    X_SUB,
+    X_MUL,
+    X_AND,
+    X_OR,
+    X_XOR,
+    X_SHL,
+    X_SHR,
+    X_EQ,
+    X_NE,
+    X_LT,
+    X_LE,
+    X_GT,
+    X_GE
+};
+#define X_IMMEDIATE 0x80
+#define X_OP(word) ((word) & 0x7F)
+#define X_ARG(word) ((word) >> 8)
+
+static inline uint32_t binary(uint32_t op, uint32_t a, uint32_t b)
+{
+    switch(op)
+    {
+    case X_ADD: return a + b;
+    case X_SUB: return a - b;
+    case X_MUL: return a * b;
+    case X_AND: return a & b;
+    case X_OR: return a | b;
+    case X_XOR: return a ^ b;
+    case X_SHL: return a << (b & 31);
+    case X_SHR: return a >> (b & 31);
+    case X_EQ: return a == b;
+    case X_NE: return a != b;
+    case X_LT: return a < b;
+    case X_LE: return a <= b;
+    case X_GT: return a > b;
+    case X_GE: return a >= b;
+    }
+    return 0;
+}
+
+static inline uint32_t unary(uint32_t op, uint32_t a)
+{
+    switch(op)
+    {
+    case X_NOT: return !a;
+    case X_NEG: return -a;
+    case X_INV: return ~a;
+    case X_BOOL: return a != 0;
+    }
+    return a;
+}
+
+static uint32_t load(const exprcontext & context, uint32_t addr, int len)
+{
+    uint32_t phys = rdram_phys(addr);
+    if(context.rdram and phys != UINT32_MAX and phys + len <= RDRAM_SIZE)
+        return rdram_read(context.rdram, 0, phys, len);
+    if(len == 4 and (addr & 3) == 0)
+        return DebugMemRead32(addr);
+    uint32_t value = 0;
+    for(int i = 0; i < len; i++)
+        value = value << 8 | uint8_t(DebugMemRead32((addr + i) & ~3u) >> (24 - 8*((addr + i) & 3)));
+    return value;
+}
+
+uint32_t expression::eval(const exprcontext & context) const
+{
+    if(constant) return value;
+    uint32_t stack[EXPR_STACK];
+    int sp = 0;
+    const uint32_t * begin = code.data(), * ip = begin, * end = begin + code.size();
+    while(ip < end)
+    {
+        uint32_t word = *ip++;
+        uint32_t op = X_OP(word);
+        switch(op)
+        {
+        case X_IMM: stack[sp++] = *ip++; break;
+        case X_REG: stack[sp++] = context.regs ? uint32_t(context.regs[X_ARG(word)]) : 0; break;
+        case X_PC: stack[sp++] = context.pc; break;
+        case X_HI: stack[sp++] = context.hi ? uint32_t(*context.hi) : 0; break;
+        case X_LO: stack[sp++] = context.lo ? uint32_t(*context.lo) : 0; break;
+        case X_LOAD8: stack[sp-1] = load(context, stack[sp-1], 1); break;
+        case X_LOAD16: stack[sp-1] = load(context, stack[sp-1], 2); break;
+        case X_LOAD32: stack[sp-1] = load(context, stack[sp-1], 4); break;
+        case X_NOT: case X_NEG: case X_INV: case X_BOOL:
+            stack[sp-1] = unary(op, stack[sp-1]);
+            break;
+        case X_JZ:
+            if(stack[sp-1] == 0) ip = begin + X_ARG(word);
+            else sp--;
+            break;
+        case X_JNZ:
+            if(stack[sp-1] != 0) stack[sp-1] = 1, ip = begin + X_ARG(word);
+            else sp--;
+            break;
+        default:
+        {
+            uint32_t b = word & X_IMMEDIATE ? *ip++ : stack[--sp];
+            stack[sp-1] = binary(op, stack[sp-1], b);
+        }
+        }
+    }
+    return sp ? stack[sp-1] : 0;
+}
+
+// result of parsing a subexpression whose code starts at code[start]
+struct operand {
+    size_t start;
+    bool constant; // code is a single X_IMM of value
+    bool boolean; // known to be 0 or 1
+    uint32_t value;
+};
+
+struct binaryop {
+    const char * token;
+    uint32_t op;
+};
+
+// lowest precedence first, like C
+static const binaryop levels[][4] = {
+    {{"||", X_JNZ}},
+    {{"&&", X_JZ}},
+    {{"|", X_OR}},
+    {{"^", X_XOR}},
+    {{"&", X_AND}},
+    {{"==", X_EQ}, {"!=", X_NE}},
+    {{"<=", X_LE}, {">=", X_GE}, {"<", X_LT}, {">", X_GT}},
+    {{"<<", X_SHL}, {">>", X_SHR}},
+    {{"+", X_ADD}, {"-", X_SUB}},
+    {{"*", X_MUL}},
+};
+#define LEVELS int(sizeof(levels)/sizeof(levels[0]))
+
+static const char * registers[32] = {
+    "r0", "at", "v0", "v1", "a0", "a1", "a2", "a3",
+    "t0", "t1", "t2", "t3", "t4", "t5", "t6", "t7",
+    "s0", "s1", "s2", "s3", "s4", "s5", "s6", "s7",
+    "t8", "t9", "k0", "k1", "gp", "sp", "fp", "ra"
+};
+
+struct exprparser {
+    const char * text;
+    const char * s;
+    std::vector<uint32_t> & code;
+    char * error;
+    bool failed = false;
+
+    operand fail(const char * what)
+    {
+        if(!failed) snprintf(error, sizeof(expression::error), "%s at column %d", what, int(s - text) + 1);
+        failed = true;
+        return {code.size(), true, false, 0};
+    }
+    void skip()
+    {
+        while(isspace((unsigned char)*s)) s++;
+    }
+    bool accept(const char * token)
+    {
+        skip();
+        size_t len = strlen(token);
+        if(strncmp(s, token, len) != 0) return false;
+        // a lone & | < > must not eat the first half of && || << >>
+        if(len == 1 and strchr("&|<>", token[0]) and s[1] == token[0]) return false;
+        s += len;
+        return true;
+    }
+    operand immediate(size_t start, uint32_t value)
+    {
+        code.resize(start);
+        code.push_back(X_IMM);
+        code.push_back(value);
+        return {start, true, value <= 1, value};
+    }
+
+    operand parse(int level)
+    {
+        if(level == LEVELS) return prefix();
+        operand lhs = parse(level + 1);
+        while(!failed)
+        {
+            uint32_t op = 0;
+            for(auto & b : levels[level])
+                if(b.token and accept(b.token))
+                {
+                    op = b.op;
+                    break;
+                }
+            if(!op) break;
+
+            if(op == X_JZ or op == X_JNZ)
+            {
+                size_t jump = code.size();
+                code.push_back(op);
+                operand rhs = parse(level + 1);
+                if(!rhs.boolean) code.push_back(X_BOOL);
+                code[jump] |= uint32_t(code.size()) << 8;
+                if(lhs.constant and rhs.constant)
+                    lhs = immediate(lhs.start, op == X_JZ ? lhs.value and rhs.value : lhs.value or rhs.value);
+                else
+                    lhs = {lhs.start, false, true, 0};
+                continue;
+            }
+
+            operand rhs = parse(level + 1);
+            if(rhs.constant and lhs.constant)
+            {
+                lhs = immediate(lhs.start, binary(op, lhs.value, rhs.value));
+                continue;
+            }
+            if(rhs.constant)
+            {
+                code.resize(rhs.start);
+                code.push_back(op | X_IMMEDIATE);
+                code.push_back(rhs.value);
+            }
+            else
+                code.push_back(op);
+            lhs = {lhs.start, false, op >= X_EQ, 0};
+        }
+        return lhs;
+    }
+
+    operand prefix()
+    {
+        skip();
+        uint32_t op = 0;
+        if(s[0] == '!' and s[1] != '=') op = X_NOT;
+        if(s[0] == '-') op = X_NEG;
+        if(s[0] == '~') op = X_INV;
+        if(!op) return primary();
+        s++;
+        operand v = prefix();
+        if(v.constant) return immediate(v.start, unary(op, v.value));
+        code.push_back(op);
+        return {v.start, false, op == X_NOT, 0};
+    }
+
+    operand memory(uint32_t op)
+    {
+        operand addr = parse(0);
+        if(!accept("]")) return fail("expected ']'");
+        // never folded: memory is read live
+        code.push_back(op);
+        return {addr.start, false, false, 0};
+    }
+
+    operand primary()
+    {
+        skip();
+        size_t start = code.size();
+        if(accept("("))
+        {
+            operand v = parse(0);
+            if(!accept(")")) return fail("expected ')'");
+            return v;
+        }
+        if(accept("[")) return memory(X_LOAD32);
+        if(isdigit((unsigned char)*s))
+        {
+            char * end;
+            bool hex = s[0] == '0' and (s[1] == 'x' or s[1] == 'X');
+            uint32_t v = strtoul(s, &end, hex ? 16 : 10);
+            s = end;
+            return immediate(start, v);
+        }
+
+        char name[8];
+        int len = 0;
+        if(*s == '$') s++;
+        while((isalnum((unsigned char)s[len]) or s[len] == '_') and len < 7)
+            name[len] = tolower(s[len]), len++;
+        name[len] = 0;
+        if(len == 0) return fail("expected a value");
+        const char * word = s;
+        s += len;
+
+        if(strcmp(name, "u8") == 0 and accept("[")) return memory(X_LOAD8);
+        if(strcmp(name, "u16") == 0 and accept("[")) return memory(X_LOAD16);
+        if(strcmp(name, "u32") == 0 and accept("[")) return memory(X_LOAD32);
+        if(strcmp(name, "pc") == 0) return code.push_back(X_PC), operand{start, false, false, 0};
+        if(strcmp(name, "hi") == 0) return code.push_back(X_HI), operand{start, false, false, 0};
+        if(strcmp(name, "lo") == 0) return code.push_back(X_LO), operand{start, false, false, 0};
+        if(strcmp(name, "zero") == 0) return immediate(start, 0);
+        int reg = -1;
+        for(int i = 0; i < 32; i++)
+            if(strcmp(name, registers[i]) == 0) reg = i;
+        if(strcmp(name, "s8") == 0) reg = 30;
+        if(name[0] == 'r' and isdigit((unsigned char)name[1]))
+        {
+            int n = atoi(name+1);
+            if(n < 32) reg = n;
+        }
+        if(reg == 0) return immediate(start, 0);
+        if(reg < 0)
+        {
+            s = word;
+            return fail("unknown name");
+        }
+        code.push_back(X_REG | reg << 8);
+        return {start, false, false, 0};
+    }
+};
+
+bool expression::compile(const char * text)
+{
+    code.clear();
+    error[0] = 0;
+    exprparser parser{text, text, code, error};
+    operand result = parser.parse(0);
+    parser.skip();
+    if(!parser.failed and *parser.s) parser.fail("unexpected text");
+    if(parser.failed)
+    {
+        code.clear();
+        constant = true;
+        value = 0;
+        return false;
+    }
+
+    // stack depth along the fall-through path; a taken jump lands where that path has the same depth
+    int depth = 0, deepest = 0;
+    for(size_t i = 0; i < code.size(); i++)
+    {
+        uint32_t word = code[i], op = X_OP(word);
+        if(op == X_IMM or (op >= X_ADD and (word & X_IMMEDIATE))) i++;
+        if(op <= X_LO) depth++;
+        else if(op == X_JZ or op == X_JNZ or (op >= X_ADD and !(word & X_IMMEDIATE))) depth--;
+        if(depth > deepest) deepest = depth;
+    }
+    if(deepest > EXPR_STACK)
+    {
+        snprintf(error, sizeof(error), "expression nests too deeply");
+        code.clear();
+        return false;
+    }
+
+    constant = result.constant;
+    value = result.value;
+    return true;
+}
@@ -0,0 +1,31 @@
+#include <stdint.h>
+#include <vector>
+
+// Integer expressions over CPU registers and N64 memory, e.g. "a0 == 0x80123456 && [0x802245B0] > 3".
+// Text is compiled once into a short stack bytecode with constants folded and constant right-hand
+// operands packed into the instruction, so evaluating costs a few dispatches and no allocation.
+// Everything is 32-bit unsigned: registers read as their low word and comparisons are unsigned.
+// [x], u16[x] and u8[x] load big-endian values from N64 memory.
+
+// max operands an expression may have pending at once
+#define EXPR_STACK 32
+
+// where evaluation reads registers and memory; a null register pointer reads as 0
+struct exprcontext {
+    const int64_t * regs = nullptr; // 32 GPRs
+    const int64_t * hi = nullptr;
+    const int64_t * lo = nullptr;
+    uint32_t pc = 0;
+    const uint32_t * rdram = nullptr; // null sends every load through the core
+};
+
+struct expression {
+    std::vector<uint32_t> code;
+    bool constant = true; // whole expression folded into value
+    uint32_t value = 0;
+    char error[64] = "";
+
+    // false on a syntax error, described in error
+    bool compile(const char * text);
+    uint32_t eval(const exprcontext & context) const;
+};
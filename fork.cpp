@@ -25,6 +25,9 @@ END PUBLIC LICENSE
 #include <stdio.h>
 #include <ncurses.h>
 #include <vector>
+#include <stdarg.h>
+#include <math.h>
+#include <algorithm>
 
 #include "include/m64p_config.h"
 #include "include/m64p_common.h"
@@ -34,6 +37,23 @@ END PUBLIC LICENSE
 #include "coreapi.h"
 
 #include "deconf.hpp"
+#include "watch.hpp"
+#include "log.hpp"
+#include "screen.hpp"
+#include "wake.hpp"
+#include "scan.hpp"
+#include "heat.hpp"
+#include "break.hpp"
+#include "record.hpp"
+#include "spark.hpp"
+#include "disasm.hpp"
+#include "profile.hpp"
+#include "trace.hpp"
+#include "coverage.hpp"
+#include "callstack.hpp"
+#include "reverse.hpp"
+#include "rewind.hpp"
+#include "rdram.hpp"
 
 #define XM(X) ptr_##X X;
 COREAPI
@@ -53,40 +73,93 @@ int initcore(void *& core)
 		return printf("Error: %s\n", Y(error))&-1;
 #define VERSION(Mj, Mn) ((Mj)<<16|(Mn))
 
-char * romdata;
-uint32_t romsize;
+#include "rom.hpp"
+#include "romid.hpp"
 
-int loadrom(const char * fname)
+double ms_since(Uint64 start)
 {
-    auto start = SDL_GetTicks();
-    puts("Loading ROM... (This usually takes about two seconds)");
-    FILE * rom = fopen(fname, "rb");
-    if(!rom) return puts("ROM file does not exist. Doublecheck the filename."), -1;
+    return (SDL_GetPerformanceCounter()-start)*1000.0/SDL_GetPerformanceFrequency();
+}
+
+const char * byteorder_names[] = {"z64", "v64", "n64", "unknown"};
+
+romidentity romid;
+// root of per-game files, see romid_gamepath
+const char * gamedata;
+
+int loadrom(const char * fname, const char * cachedir, const char * index)
+{
+    puts("Loading ROM...");
+    auto start = SDL_GetPerformanceCounter();
     
-    fseek(rom, 0, SEEK_END);
-    romsize = ftell(rom);
-    fseek(rom, 0, SEEK_SET);
-    romdata = (char*)malloc(romsize);
+    // a hit means the file is unchanged since it was last hashed
+    bool indexed = romid_index_lookup(index, fname, romid) == 0;
     
-    if(!romdata) return puts("Allocation error when loading ROM."), fclose(rom), -1;
-    if(fread(romdata, 1024, romsize/1024, rom)*1024 != romsize) return puts("Failed to load ROM data into RAM. (ROM filesize might not be a 1024-byte multiple)"), free(romdata), fclose(rom), -1;
+    romimage rom;
+    if(rom_map(rom, fname)) return -1;
+    auto t_map = ms_since(start);
     
-    fclose(rom);
+    auto container = rom_container(rom);
+    if(container != ROM_RAW)
+    {
+        rom_prefetch(rom);
+        inflatestats stats;
+        if(rom_decompress(rom, container, stats)) return rom_unmap(rom), -1;
+        printf("Decompressed %s ROM: %u members on %d threads, first byte after %.3fms, %.3fms total (%.1f MiB/s)\n",
+            container == ROM_GZIP ? "gzip" : "zip", stats.members, stats.threads, stats.first_byte_ms, stats.total_ms,
+            rom.size / 1048576.0 / (stats.total_ms > 0 ? stats.total_ms/1000.0 : 1));
+    }
     
-    if(auto error = CoreDoCommand(M64CMD_ROM_OPEN, romsize, romdata))
+    // byteswapped dumps get normalized once and then served from the cache, keyed by the identity of the z64 image;
+    // the identity comes from the size+mtime index, so a launch that hits both neither swaps nor hashes
+    auto phase = SDL_GetPerformanceCounter();
+    auto order = rom_byteorder(rom);
+    bool swapped = order == ROM_V64 or order == ROM_N64;
+    if(swapped and indexed and rom_cache_lookup(rom, cachedir, romid.hash64) == 0)
     {
-        free(romdata);
+        printf("Using cached z64 image of %s ROM.\n", byteorder_names[order]);
+        swapped = false;
+    }
+    else if(swapped)
+    {
+        rom_prefetch(rom);
+        if(rom_normalize(rom, order)) return rom_unmap(rom), -1;
+        printf("Normalized %s ROM to z64 byte order.\n", byteorder_names[order]);
+    }
+    rom_prefetch(rom);
+    auto t_swap = ms_since(phase);
+    
+    phase = SDL_GetPerformanceCounter();
+    if(!indexed)
+    {
+        romid_compute(romid, rom.data, rom.size);
+        if(romid_index_store(index, fname, romid))
+            printf("Could not write ROM index %s.\n", index);
+    }
+    if(swapped and rom_cache_store(rom, cachedir, romid.hash64))
+        printf("Could not write normalized ROM to cache directory %s.\n", cachedir);
+    auto t_hash = ms_since(phase);
+    printf("ROM identity: crc32 %08X md5 %s hash %016llX%s\n", romid.crc32, romid.md5, (unsigned long long)romid.hash64, indexed ? " (indexed)" : "");
+    
+    phase = SDL_GetPerformanceCounter();
+    if(auto error = CoreDoCommand(M64CMD_ROM_OPEN, rom.size, rom.data))
+    {
+        rom_unmap(rom);
         printf("Error: %s\n",CoreErrorMessage(error));
         return -1;
     }
+    auto t_open = ms_since(phase);
     
     puts("Done loading ROM.");
     
-    auto end = SDL_GetTicks();
+    auto size = rom.size;
+    rom_unmap(rom); // The core copies the ROM buffer so we can release it immediately even if we don't error out.
     
-    printf("Time to load ROM: %.3f\n", (end-start)/1000.0f);
+    m64p_rom_settings info;
+    if(CoreDoCommand(M64CMD_ROM_GET_SETTINGS, sizeof(info), &info) == M64ERR_SUCCESS and info.MD5[0] and strcasecmp(info.MD5, romid.md5) != 0)
+        printf("Core reports a different MD5 (%s); the ROM index may be stale.\n", info.MD5);
     
-    free(romdata); // The core copies the ROM buffer so we can free it immediately even if we don't error out.
+    printf("Time to load ROM: %.3fms (map %.3fms, byteorder %.3fms, hash %.3fms, core %.3fms, %u bytes)\n", ms_since(start), t_map, t_swap, t_hash, t_open, size);
     
     return 0;
 }
@@ -97,6 +170,7 @@ void(*real_print)(const char *, int, const char *);
 #include <string>
 #include <sstream>
 
+// guards msglog between the log writer thread and the UI
 SDL_mutex * logmutex;
 std::deque<std::string> msglog;
 
@@ -104,7 +178,6 @@ std::deque<std::string> msglog;
 
 void print_terminal(const char * ctx, int level, const char * msg)
 {
-    printf("%s: %s\n", ctx, msg);
     std::ostringstream temp;
     temp << ctx << ": "
     << ((level == M64MSG_WARNING) ? "WARN : " : (level == M64MSG_ERROR) ? "ERROR : " : "")
@@ -115,26 +188,49 @@ void print_terminal(const char * ctx, int level, const char * msg)
 
 void print_curses(const char * ctx, int level, const char * msg)
 {
-    printf("%s: %s\n", ctx, msg);
     std::ostringstream temp;
     temp << ctx << ": " << msg;
     msglog.push_back(temp.str());
     while(msglog.size() > msglog_height) msglog.pop_front();
 }
 
-void debug(void * ctx, int level, const char * msg)
+#define logring_size 4096
+
+logring pending_log(logring_size);
+
+// called on the log writer thread for every record it takes from pending_log
+void display_log(const logrecord & rec)
 {
-    // video plugin messages are *important*
-    if(level <= M64MSG_WARNING or (strcmp((const char *)ctx, "Video") == 0 and level <= M64MSG_STATUS))
+    if(SDL_LockMutex(logmutex) == 0)
     {
-        if(SDL_LockMutex(logmutex) == 0)
-        {
-            real_print((const char *)ctx, level, msg);
-            SDL_UnlockMutex(logmutex);
-        }
+        real_print(rec.ctx, rec.level, rec.msg);
+        SDL_UnlockMutex(logmutex);
     }
-    fflush(stdout);
-    fflush(stderr);
+    ui_wake();
+}
+
+logfilter log_filter;
+
+// message sources get an interned id as their callback context
+void * log_context(const char * name, int rate)
+{
+    // video plugin messages are *important*
+    int max_level = strcmp(name, "Video") == 0 ? M64MSG_STATUS : M64MSG_WARNING;
+    return (void *)(intptr_t)log_filter.intern(name, max_level, rate, rate*2);
+}
+
+void flush_log_filter()
+{
+    log_filter.flush(pending_log);
+}
+
+void debug(void * ctx, int level, const char * msg)
+{
+    auto id = (intptr_t)ctx;
+    // the filter passes sources it never interned; they have no name of their own
+    bool known = id >= 0 and id < log_filter.count;
+    if(log_filter.accept(id, level, msg, pending_log))
+        pending_log.push(known ? log_filter.contexts[id].name : "?", level, msg);
 }
 
 namespace Plug
@@ -170,23 +266,259 @@ funcptr LoadFunction ( const char * funcname, void * object )
 
 std::atomic<bool> emulating;
 
+// watches are sampled on the emulation thread once per frame and handed to the UI through frames
+watchsampler watch;
+framering frames;
+
+#define framering_size 256
+
+// Watches come from the settings watch0, watch1, ... as "<type> <address>", where the address can
+// follow pointers: "f32 [[80200000]+10]+44". Without any, a few defaults are shown.
+void setup_watchlist(deconf & settings)
+{
+    const char * defaults[] = {"f32 802245B8", "f32 802245BC", "f32 802245C0", "u32 802245F4", "char 80200000"};
+    bool configured = false;
+    for(int i = 0; i < 64; i++)
+    {
+        char key[16];
+        snprintf(key, sizeof(key), "watch%d", i);
+        if(!settings.is_string(key)) continue;
+        configured = true;
+        if(!watch.add(settings.get_string(key)))
+            printf("Ignoring watch %s: can't parse \"%s\".\n", key, settings.get_string(key));
+    }
+    if(!configured)
+        for(auto text : defaults)
+            watch.add(text);
+    watch.build();
+    frames.init(framering_size, watch.stride());
+}
+
+// the RDRAM block never moves once the core has it, so it's only looked up until it exists
+const uint32_t * rdram()
+{
+    static std::atomic<const uint32_t *> base{nullptr};
+    if(!base) base = (const uint32_t *) DebugMemGetPointer(M64P_DBG_PTR_RDRAM);
+    return base;
+}
+
+scanner scan;
+rdramdiff heat;
+reverser rev;
+profiler prof;
+uint32_t prof_shift = 4; // setting "profile_shift": log2 of the profiler's bucket size
+
+recorder_config record_config;
+rewinder_config rewind_config;
+
+void rewind_report(const char * text)
+{
+    pending_log.push("UI", M64MSG_INFO, text);
+}
+
+// records every watch into path, one row per frame; false if the file can't be written
+bool start_recording(const char * path)
+{
+    std::vector<columninfo> columns;
+    for(size_t i = 0; i < watch.entries.size(); i++)
+        columns.push_back({watch.entries[i].mode == float_ ? COLUMN_XOR : COLUMN_DELTA, watch.sources[i]});
+    record_config.path = path;
+    return recorder_start(record_config, columns) == 0;
+}
+
+void frame_callback(unsigned int frame)
+{
+    // the recorder wants every frame, even the ones the UI's ring has no room for
+    static std::vector<uint32_t> spare, row;
+    auto slot = frames.reserve();
+    bool queued = slot != nullptr;
+    if(!queued and recorder_active())
+    {
+        spare.resize(watch.stride());
+        slot = spare.data();
+    }
+    if(slot and watch.sample(slot))
+    {
+        if(recorder_active())
+        {
+            row.resize(watch.entries.size());
+            watch.values(slot, row.data());
+            recorder_push(frame, row.data());
+        }
+        if(queued)
+        {
+            frames.commit(frame);
+            ui_wake();
+        }
+    }
+    // whoever clears want_capture owns the capture; the UI may take it while the core is parked
+    if(rdram() and scan.want_capture.exchange(false))
+    {
+        scan.capture(rdram());
+        ui_wake();
+    }
+    if(heat.enabled and rdram())
+        heat.step(rdram());
+    if(prof.running and prof.rate == 0)
+        prof.sample();
+    rewinder_frame();
+    // after the rewind buffer, which captures far less often and would otherwise wait behind it
+    rev.frame();
+}
+
+breakmanager breaks;
+bool debugger_enabled = false;
+// the user's core settings from before this session changed them, or -1
+int saved_enable_debugger = -1;
+int saved_r4300_emulator = -1;
+
+void restore_core_config()
+{
+    m64p_handle coreconf;
+    if(ConfigOpenSection("Core", &coreconf) != M64ERR_SUCCESS) return;
+    if(saved_enable_debugger >= 0) ConfigSetParameter(coreconf, "EnableDebugger", M64TYPE_BOOL, &saved_enable_debugger);
+    if(saved_r4300_emulator >= 0) ConfigSetParameter(coreconf, "R4300Emulator", M64TYPE_INT, &saved_r4300_emulator);
+}
+bool start_paused = false;
+
+tracer_config trace_config;
+coverage cover;
+bool cover_prof = false; // "cover on sample" started the profiler, so "cover off" stops it
+callstack calls;
+bool reverse_at_start = false;
+
+// a rewind takes emulation back to an older state; what was recorded after it is from a run that no
+// longer happened
+void rewind_loaded()
+{
+    if(rev.enabled) rev.start();
+    calls.reset_requested = true;
+    heat.reprime_requested = true;
+    if(tracer_active())
+        pending_log.push("Rewind", M64MSG_WARNING, "The trace goes on from the rewound state; what it holds after that point was undone.");
+}
+
+// the core reports savestates it has written or loaded; the rewind buffer and reverse stepping wait
+// on their own, and each takes only the answers to the jobs it claimed
+void state_changed(void *, m64p_core_param param, int value)
+{
+    if(param == M64CORE_STATE_SAVECOMPLETE)
+    {
+        rewinder_saved(value != 0);
+        rev.saved(value != 0);
+    }
+    if(param == M64CORE_STATE_LOADCOMPLETE)
+    {
+        rewinder_loaded(value != 0);
+        rev.loaded(value != 0);
+    }
+    if(param == M64CORE_EMU_STATE and value == M64EMU_STOPPED)
+    {
+        rewinder_halted();
+        rev.halted();
+    }
+}
+
+bool reverse_breakpoint(uint32_t pc)
+{
+    return breaks.match(pc) >= 0;
+}
+
+// Tracing and exact coverage step the core, which then reports every instruction to debugger_update;
+// breakpoints and pauses still stop it, and it goes back to stepping when they continue.
+void update_run_state()
+{
+    bool every = tracer_active() or cover.stepping or calls.enabled or rev.enabled;
+    breaks.run_state = every ? M64P_DBG_RUNSTATE_STEPPING : M64P_DBG_RUNSTATE_RUNNING;
+    if(!breaks.hold) DebugSetRunState(breaks.run_state);
+}
+
+bool start_tracing(const char * path)
+{
+    trace_config.path = path;
+    if(tracer_start(trace_config) != 0) return false;
+    update_run_state();
+    return true;
+}
+
+void stop_tracing()
+{
+    tracer_stop();
+    update_run_state();
+}
+
+void debugger_init()
+{
+    breaks.attach(start_paused);
+    calls.attach();
+    rev.attach();
+    rev.breakpoint = reverse_breakpoint;
+    if(reverse_at_start)
+    {
+        rev.start();
+        update_run_state();
+    }
+}
+
+// runs on the emulation thread each time the core's debugger stops, and before every instruction
+// while tracing
+void debugger_update(unsigned int pc)
+{
+    if(breaks.run_state == M64P_DBG_RUNSTATE_STEPPING)
+    {
+        // a reverse replay reruns history, which nothing else should see twice
+        bool replaying = rev.mode != REVERSE_IDLE;
+        if(rev.step(pc))
+        {
+            breaks.park(rev.stop_pc);
+            if(rev.error[0])
+            {
+                char text[LOG_MSG_SIZE];
+                snprintf(text, sizeof(text), "Reverse: %s.", rev.error);
+                pending_log.push("Debug", M64MSG_WARNING, text);
+            }
+            return ui_wake();
+        }
+        // the core pauses at its own breakpoints on the way
+        if(replaying) return (void)DebugSetRunState(M64P_DBG_RUNSTATE_STEPPING);
+        tracer_step(pc);
+        if(cover.stepping) cover.mark(pc);
+        if(calls.enabled) calls.step(pc);
+        // still stepping means no breakpoint was reached
+        if(!breaks.hold and DebugGetState(M64P_DBG_RUN_STATE) == M64P_DBG_RUNSTATE_STEPPING) return;
+    }
+    if(!breaks.update(pc)) return;
+    if(breaks.stop_index >= 0)
+    {
+        char text[LOG_MSG_SIZE];
+        snprintf(text, sizeof(text), "Breakpoint %d hit at %08X.", breaks.stop_index, pc);
+        pending_log.push("Debug", M64MSG_INFO, text);
+    }
+    ui_wake();
+}
+
 int emulate()
 {
     TRY_OR_DIE(CoreDoCommand(M64CMD_EXECUTE, 0, NULL), CoreErrorMessage)
     emulating = 0;
+    ui_wake();
     return 0;
 }
 
 #define C_INVALID '.'
 #define C_UNPRINTABLE '.'
 
+screenbuffer screen;
+// redraws are capped at this rate; anything arriving faster is folded into the next frame
+int ui_max_fps = 60;
+
 void blit_char(char c, bool underline = false)
 {
     unsigned char uc = (unsigned char)c;
-    if(uc < 32) return (void)addch(c+32 | A_BOLD | (A_UNDERLINE * underline));
-    if(uc == 127) return (void)addch('.' | A_BOLD | (A_UNDERLINE * underline));
+    if(uc < 32) return screen.put(c+32 | A_BOLD | (A_UNDERLINE * underline));
+    if(uc == 127) return screen.put('.' | A_BOLD | (A_UNDERLINE * underline));
     if(uc > 127) return blit_char(c-128, true);
-    return (void)addch(c);
+    return screen.put(uc);
 }
 
 void print_custom(const char * str, uint32_t len)
@@ -220,10 +552,23 @@ int init()
 {
     // environment
     
-    freopen("log.txt", "w", stdout);
-    freopen("err.txt", "w", stderr);
+    auto settings = deconf_load("config.txt");
+    
+    logmutex = SDL_CreateMutex();
+    if(!logmutex) return puts("Could not initialize SDL mutex. Check your OS."), -1;
     real_print = print_terminal;
     
+    logwriter_config logconf;
+    logconf.rotate_bytes = settings.get_real("log_rotate_kb", logconf.rotate_bytes/1024)*1024;
+    logconf.keep = settings.get_real("log_keep", logconf.keep);
+    logconf.flush_ms = settings.get_real("log_flush_ms", logconf.flush_ms);
+    logconf.on_wake = flush_log_filter;
+    int log_rate = settings.get_real("log_rate", 200);
+    ui_max_fps = settings.get_real("ui_max_fps", ui_max_fps);
+    if(ui_wake_init()) return puts("Could not create UI wakeup pipe."), -1;
+    if(logwriter_start(logconf, &pending_log, display_log)) return puts("Could not start log writer."), -1;
+    freopen("err.txt", "w", stderr);
+    
     // set up curses
     
     real_stdout = fopen(TERMINAL, "w");
@@ -256,11 +601,6 @@ int init()
     int version_conf, version_debug, version_video, version_extra;
     version_conf = version_debug = version_video = version_extra = -1;
     
-    logmutex = SDL_CreateMutex();
-    if(!logmutex) return puts("Could not initialize SDL mutex. Check your OS."), -1;
-    
-    auto settings = deconf_load("config.txt");
-    
     // set up emulator
 
     if(!settings.is_string("core")) settings.make_string("core", "libmupen64plus.so.2");
@@ -276,8 +616,12 @@ int init()
     
     printf("Debug version: %X.%X\n", version_debug>>16, version_debug&0xFFFF);
     
-    TRY_OR_DIE(CoreStartup(VERSION(2,0), "config/", "config/", (void*)"Core", &debug, NULL, NULL), CoreErrorMessage)
-    TRY_OR_DIE(DebugSetCallbacks(NULL, NULL, NULL), CoreErrorMessage)
+    TRY_OR_DIE(CoreStartup(VERSION(2,0), "config/", "config/", log_context("Core", log_rate), &debug, NULL, state_changed), CoreErrorMessage)
+    
+    // breakpoints need the core's debugger, which slows emulation down; "debugger 1" turns it on
+    debugger_enabled = settings.get_real("debugger", 0) != 0;
+    start_paused = settings.get_real("start_paused", 0) != 0;
+    TRY_OR_DIE(DebugSetCallbacks(debugger_init, debugger_update, NULL), CoreErrorMessage)
     
     // plugins
     
@@ -286,7 +630,7 @@ int init()
     if(!Plug::type) return printf("Failed to load a plugin.\n%s\n",SDL_GetError()), -1; \
     if(!(Plug::type##Startup = LoadFunction<ptr_PluginStartup>("PluginStartup", Plug::type))) \
         return puts(#type " plugin is not a valid m64p plugin (no startup)."), -1; \
-    if(auto error = Plug::type##Startup(core, (void *) #type, &debug)) \
+    if(auto error = Plug::type##Startup(core, log_context(#type, log_rate), &debug)) \
         return printf(#type " plugin errored while starting up: %s\n", CoreErrorMessage(error)), -1; \
     else  puts(#type " plugin loaded successfully.");
     
@@ -307,7 +651,11 @@ int init()
     ConfigSaveFile();
     
     if(!settings.is_string("rom")) settings.make_string("rom", "zelda.z64");
-    if(loadrom(settings.get_string("rom"))) return puts("Failed ro load ROM."), -1;
+    if(!settings.is_string("romcache")) settings.make_string("romcache", "romcache");
+    if(!settings.is_string("romindex")) settings.make_string("romindex", "romcache/index.txt");
+    if(!settings.is_string("gamedata")) settings.make_string("gamedata", "games");
+    gamedata = strdup(settings.get_string("gamedata"));
+    if(loadrom(settings.get_string("rom"), settings.get_string("romcache"), settings.get_string("romindex"))) return puts("Failed ro load ROM."), -1;
     
     #define ATTACH(x) \
         if(auto error = CoreAttachPlugin(x##Type, Plug::x)) \
@@ -320,32 +668,1056 @@ int init()
     
     ConfigSaveFile();
     
+    // set after the save, for this session only; put back on the way out
+    m64p_handle coreconf;
+    if(ConfigOpenSection("Core", &coreconf) == M64ERR_SUCCESS)
+    {
+        saved_enable_debugger = ConfigGetParamInt(coreconf, "EnableDebugger");
+        int enable_debugger = debugger_enabled;
+        ConfigSetParameter(coreconf, "EnableDebugger", M64TYPE_BOOL, &enable_debugger);
+    }
+    
+    prof.skip = &breaks.stopped;
+    prof.cover = &cover;
+    prof_shift = settings.get_real("profile_shift", prof_shift);
+    setup_watchlist(settings);
+    record_config.block_rows = settings.get_real("record_block", record_config.block_rows);
+    record_config.level = settings.get_real("record_level", record_config.level);
+    if(settings.is_string("record") and !start_recording(settings.get_string("record")))
+        printf("Could not start recording to %s.\n", settings.get_string("record"));
+    trace_config.block = settings.get_real("trace_block", trace_config.block);
+    trace_config.level = settings.get_real("trace_level", trace_config.level);
+    // reverse stepping numbers instructions, which only the pure interpreter reports one by one
+    reverse_at_start = debugger_enabled and settings.get_real("reverse", 0) != 0;
+    rev.budget_pages = settings.get_real("reverse_mb", 256) * (1024*1024 / REVERSE_PAGE_BYTES);
+    rev.target_ms = settings.get_real("reverse_ms", rev.target_ms);
+    if(reverse_at_start and ConfigOpenSection("Core", &coreconf) == M64ERR_SUCCESS)
+    {
+        saved_r4300_emulator = ConfigGetParamInt(coreconf, "R4300Emulator");
+        int pure_interpreter = 0;
+        ConfigSetParameter(coreconf, "R4300Emulator", M64TYPE_INT, &pure_interpreter);
+    }
+    rewind_config.every = settings.get_real("rewind_frames", rewind_config.every);
+    rewind_config.budget_mb = settings.get_real("rewind_mb", rewind_config.budget_mb);
+    rewind_config.level = settings.get_real("rewind_level", rewind_config.level);
+    rewind_config.report = rewind_report;
+    rewind_config.loaded = rewind_loaded;
+    m64p_rom_header header;
+    if(CoreDoCommand(M64CMD_ROM_GET_HEADER, sizeof(header), &header) == M64ERR_SUCCESS and (header.Country_code & 0xFF)
+        and strchr("DFIPSUXY", header.Country_code & 0xFF))
+        rewind_config.fps = 50;
+    if(settings.get_real("rewind", 0) != 0 and rewinder_start(rewind_config) != 0)
+        puts("Could not start the rewind buffer.");
+    if(settings.is_string("trace") and debugger_enabled and !start_tracing(settings.get_string("trace")))
+        printf("Could not start tracing to %s.\n", settings.get_string("trace"));
+    TRY_OR_DIE(CoreDoCommand(M64CMD_SET_FRAME_CALLBACK, 0, (void *)frame_callback), CoreErrorMessage)
+    
     return 0;
 }
 
+// what the left side of the debugger shows
+enum {
+    PANE_NONE,
+    PANE_SCAN,
+    PANE_HEAT,
+    PANE_HEX,
+    PANE_BREAK,
+    PANE_CHART,
+    PANE_DISASM,
+    PANE_PROFILE,
+    PANE_COVER,
+    PANE_CALLS
+};
+int pane = PANE_NONE;
+
+// shows a line in the message pane; for the UI's own feedback
+void ui_message(const char * format, ...)
+{
+    char text[LOG_MSG_SIZE];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    pending_log.push("UI", M64MSG_INFO, text);
+}
+
+// a scan command waits for the next frame to hand over a consistent copy of RDRAM
+struct {
+    bool pending = false;
+    bool start;
+    int type;
+    int mode;
+    scanvalue lo, hi;
+} scan_op;
+
+scanvalue parse_scanvalue(const char * text, int type)
+{
+    scanvalue v;
+    if(type == SCAN_FLOAT) v.f = strtof(text, nullptr);
+    else v.u = strtoul(text, nullptr, 0);
+    return v;
+}
+
+void command_scan(const char * args)
+{
+    char word[16] = "", a[32] = "", b[32] = "";
+    int n = sscanf(args, "%15s %31s %31s", word, a, b);
+    const char * types[] = {"u8", "u16", "u32", "float"};
+    if(scan_op.pending) return ui_message("The last scan is still waiting for a frame.");
+    int type = -1;
+    for(int t = 0; t < 4; t++)
+        if(n >= 1 and strcmp(word, types[t]) == 0) type = t;
+    if(type >= 0)
+    {
+        scan_op.start = true;
+        scan_op.type = type;
+        scan_op.pending = true;
+    }
+    else
+    {
+        if(!scan.active) return ui_message("No scan running; start one with \"scan u8|u16|u32|float\".");
+        scan_op.start = false;
+        scan_op.pending = true;
+        if(n >= 2 and strcmp(word, "=") == 0)
+            scan_op.mode = SCAN_EXACT, scan_op.lo = parse_scanvalue(a, scan.type);
+        else if(n >= 3 and strcmp(word, "range") == 0)
+            scan_op.mode = SCAN_RANGE, scan_op.lo = parse_scanvalue(a, scan.type), scan_op.hi = parse_scanvalue(b, scan.type);
+        else if(strcmp(word, "changed") == 0) scan_op.mode = SCAN_CHANGED;
+        else if(strcmp(word, "unchanged") == 0) scan_op.mode = SCAN_UNCHANGED;
+        else if(strcmp(word, "inc") == 0 or strcmp(word, "increased") == 0) scan_op.mode = SCAN_INCREASED;
+        else if(strcmp(word, "dec") == 0 or strcmp(word, "decreased") == 0) scan_op.mode = SCAN_DECREASED;
+        else if(strcmp(word, "off") == 0) scan.active = false, scan_op.pending = false;
+        else if(n >= 1 and (isdigit(word[0]) or word[0] == '-' or word[0] == '.'))
+            scan_op.mode = SCAN_EXACT, scan_op.lo = parse_scanvalue(word, scan.type);
+        else
+            return scan_op.pending = false, ui_message("Unknown scan filter \"%s\".", word);
+    }
+    if(scan_op.pending)
+    {
+        scan.captured = false;
+        scan.want_capture = true;
+    }
+}
+
+// runs a pending scan once its capture arrived; captures directly while the core is parked in the
+// debugger, where no frame will come. Slow frames (stepping for a trace) are waited for.
+void update_scan()
+{
+    if(!scan_op.pending) return;
+    if(!scan.captured)
+    {
+        // the frame callback may have taken the capture already; then it sets captured shortly
+        if(!breaks.stopped or !rdram() or !scan.want_capture.exchange(false)) return;
+        scan.capture(rdram());
+    }
+    scan.captured = false;
+    scan_op.pending = false;
+    if(scan_op.start)
+        scan.start(scan_op.type);
+    else
+        scan.filter(scan_op.mode, scan_op.lo, scan_op.hi);
+}
+
+void command_heat(const char * args)
+{
+    char word[16] = "";
+    sscanf(args, "%15s", word);
+    if(strcmp(word, "off") == 0)
+        return (void)(heat.enabled = false);
+    if(strcmp(word, "reset") == 0)
+        heat.reset_requested = true;
+    else if(int g = atoi(word))
+    {
+        if(g != 4 and g != 16 and g != 64) return ui_message("Heatmap blocks must be 4, 16 or 64 bytes.");
+        heat.requested_granularity = g;
+    }
+    else if(word[0] and strcmp(word, "on") != 0)
+        return ui_message("Unknown heat option \"%s\".", word);
+    // RDRAM moved on while heat was off; diffing against the old snapshot would count all of it at once
+    if(!heat.enabled) heat.reprime_requested = true;
+    heat.enabled = true;
+    pane = PANE_HEAT;
+}
+
+void draw_scan(int top, int bottom)
+{
+    if(!scan.active) return;
+    std::vector<uint32_t> addresses, values;
+    const char * types[] = {"u8", "u16", "u32", "float"};
+    int y = top;
+    screen.at(y++, 0);
+    screen.format("Scan %s: %u candidates (%.2fms)%s", types[scan.type], scan.count, scan.last_ms, scan_op.pending ? " ..." : "");
+    int rows = bottom - y;
+    scan.results(addresses, values, rows > 0 ? rows : 0);
+    for(size_t i = 0; i < addresses.size(); i++)
+    {
+        screen.at(y++, 0);
+        if(scan.type == SCAN_FLOAT)
+            screen.format("0x%08X : %g", addresses[i], *(float *)&values[i]);
+        else
+            screen.format("0x%08X : %0*X", addresses[i], scan.width()*2, values[i]);
+    }
+}
+
+// Hex viewer: only the rows on screen are read, straight from RDRAM.
+// Bytes that differ from the previous refresh of the same row are highlighted.
+struct {
+    uint32_t top = 0x80000000;
+    int rows = 0;
+    std::vector<uint8_t> last; // bytes shown at the last refresh
+    uint32_t last_top = 0;
+} hexview;
+
+// byte -> two hex digits, byte -> printable ASCII, built once instead of formatting per byte
+struct hextables {
+    char hex[256][2];
+    char ascii[256];
+    hextables()
+    {
+        const char digits[] = "0123456789ABCDEF";
+        for(int i = 0; i < 256; i++)
+        {
+            hex[i][0] = digits[i >> 4];
+            hex[i][1] = digits[i & 15];
+            ascii[i] = (i >= 32 and i < 127) ? i : '.';
+        }
+    }
+};
+const hextables hextable;
+
+void draw_hex(int top, int bottom)
+{
+    int rows = bottom - top;
+    hexview.rows = rows;
+    auto base = rdram();
+    if(rows <= 0) return;
+    if(!base)
+    {
+        screen.at(top, 0);
+        return screen.text("RDRAM not available yet.");
+    }
+    
+    std::vector<uint8_t> shown(size_t(rows)*16);
+    // rows keep their highlight history only if they are still at the same place on screen
+    bool comparable = hexview.last_top == hexview.top and hexview.last.size() == shown.size();
+    for(int r = 0; r < rows; r++)
+    {
+        uint32_t addr = hexview.top + r*16;
+        uint32_t phys = rdram_phys(addr);
+        screen.at(top + r, 0);
+        screen.style(COLOR_PAIR(1));
+        screen.format("%08X ", addr);
+        screen.style(COLOR_PAIR(2));
+        if(phys == UINT32_MAX or phys + 16 > RDRAM_SIZE) continue;
+        
+        auto row = &shown[size_t(r)*16];
+        for(int i = 0; i < 16; i++)
+            row[i] = rdram_byte(base, 0, phys + i);
+        auto old = comparable ? &hexview.last[size_t(r)*16] : row;
+        
+        for(int i = 0; i < 16; i++)
+        {
+            chtype mark = row[i] != old[i] ? A_REVERSE : 0;
+            screen.put(hextable.hex[row[i]][0] | mark);
+            screen.put(hextable.hex[row[i]][1] | mark);
+            screen.put(' ');
+            if(i == 7) screen.put(' ');
+        }
+        screen.put(' ');
+        for(int i = 0; i < 16; i++)
+            screen.put(hextable.ascii[row[i]] | (row[i] != old[i] ? A_REVERSE : 0));
+    }
+    hexview.last.swap(shown);
+    hexview.last_top = hexview.top;
+}
+
+void scroll_hex(int64_t bytes)
+{
+    int64_t top = int64_t(hexview.top) + bytes;
+    int64_t last = 0x80000000LL + RDRAM_SIZE - 16;
+    if(top < 0x80000000LL) top = 0x80000000LL;
+    if(top > last) top = last;
+    hexview.top = uint32_t(top) & ~15u;
+}
+
+void command_break(const char * args)
+{
+    const char * usage = "Usage: break [r|w|rw] <address>[-<end>] [if <condition>]";
+    unsigned flags = M64P_BKP_FLAG_EXEC;
+    char kind[4] = "";
+    int used = 0;
+    if(sscanf(args, " %3s %n", kind, &used) == 1)
+    {
+        if(strcmp(kind, "r") == 0) flags = M64P_BKP_FLAG_READ;
+        if(strcmp(kind, "w") == 0) flags = M64P_BKP_FLAG_WRITE;
+        if(strcmp(kind, "rw") == 0) flags = M64P_BKP_FLAG_READ | M64P_BKP_FLAG_WRITE;
+        if(flags != M64P_BKP_FLAG_EXEC) args += used;
+    }
+    char * end;
+    uint32_t start = strtoul(args, &end, 16);
+    if(end == args) return ui_message(usage);
+    uint32_t last = start;
+    if(*end == '-') last = strtoul(end+1, &end, 16);
+    while(*end == ' ') end++;
+    const char * condition = nullptr;
+    if(strncmp(end, "if ", 3) == 0) condition = end + 3;
+    else if(*end) return ui_message(usage);
+    if(last < start) return ui_message("Breakpoint range ends before it starts.");
+    
+    int index = breaks.add(start, last, flags, condition);
+    if(index < 0) return ui_message("Breakpoint not set: %s.", breaks.error);
+    pane = PANE_BREAK;
+    if(!debugger_enabled) ui_message("The core's debugger is off (setting \"debugger\"), so breakpoints won't trigger.");
+}
+
+// breakpoint number from a command argument, or -1 after saying what's wrong
+int parse_breakpoint(const char * args)
+{
+    char * end;
+    long index = strtol(args, &end, 10);
+    if(end == args or index < 0 or index >= long(breaks.points.size()))
+        return ui_message("No breakpoint \"%s\".", args), -1;
+    return index;
+}
+
+void command_record(const char * args)
+{
+    char path[256] = "";
+    sscanf(args, "%255s", path);
+    if(strcmp(path, "off") == 0 or (!path[0] and recorder_active()))
+    {
+        if(!recorder_active()) return ui_message("Not recording.");
+        recorder_stop();
+        return ui_message("Recording stopped: %llu frames, %llu KB.", (unsigned long long)recordstats.rows.load(),
+            (unsigned long long)recordstats.bytes.load()/1024);
+    }
+    if(recorder_active()) return ui_message("Already recording; \"record off\" first.");
+    if(!path[0]) strcpy(path, "record.bac");
+    if(!start_recording(path)) return ui_message("Could not start recording to %s.", path);
+    ui_message("Recording %u watches to %s.", unsigned(watch.entries.size()), path);
+}
+
+void command_trace(const char * args)
+{
+    char path[256] = "";
+    sscanf(args, "%255s", path);
+    if(strcmp(path, "off") == 0 or (!path[0] and tracer_active()))
+    {
+        if(!tracer_active()) return ui_message("Not tracing.");
+        stop_tracing();
+        return ui_message("Trace stopped: %llu instructions, %llu KB.", (unsigned long long)tracestats.instructions.load(),
+            (unsigned long long)tracestats.bytes.load()/1024);
+    }
+    if(tracer_active()) return ui_message("Already tracing; \"trace off\" first.");
+    if(!debugger_enabled) return ui_message("Tracing needs the core's debugger (setting \"debugger\").");
+    if(!path[0]) strcpy(path, "trace.bac");
+    if(!start_tracing(path)) return ui_message("Could not start tracing to %s.", path);
+    ui_message("Tracing every instruction to %s.", path);
+}
+
+// Coverage runs are saved per ROM as <gamedata>/<hash>/coverage-<name>.cov; "live" is the running game.
+coverageset cover_result;
+uint64_t cover_result_count = 0;
+std::vector<coveragerange> cover_ranges;
+char cover_title[64+16+64] = ""; // two run names and an operator
+uint64_t cover_live_count = 0; // the live bitmap's count, redone once a second for the pane
+Uint32 cover_live_counted = 0;
+uint32_t cover_top = 0; // first range shown
+
+bool cover_path(char * out, size_t len, const char * name)
+{
+    if(!romid.valid) return false;
+    char file[96];
+    snprintf(file, sizeof(file), "coverage-%s.cov", name);
+    romid_gamepath(out, len, gamedata, romid, file);
+    return true;
+}
+
+bool cover_load(const char * name, coverageset & out)
+{
+    if(strcmp(name, "live") == 0) return cover.snapshot(out), true;
+    char path[512];
+    if(!cover_path(path, sizeof(path), name) or !out.load(path))
+        return ui_message("No coverage run \"%s\".", name), false;
+    return true;
+}
+
+void command_cover(const char * args)
+{
+    char word[16] = "", a[64] = "", b[64] = "";
+    sscanf(args, "%15s %63s %63s", word, a, b);
+    if(!word[0] or strcmp(word, "on") == 0)
+    {
+        // exact by default; sampling when there's no debugger to step with, or when asked
+        bool step = strcmp(a, "sample") != 0 and debugger_enabled;
+        if(strcmp(a, "step") == 0 and !debugger_enabled) return ui_message("Stepping needs the core's debugger (setting \"debugger\").");
+        cover.stepping = step;
+        cover.sampling = !step;
+        if(step and cover_prof) prof.stop();
+        if(step) cover_prof = false;
+        else if(!prof.running)
+        {
+            if(!prof.start(1000, prof_shift)) return ui_message("Could not start the profiler.");
+            cover_prof = true;
+        }
+        update_run_state();
+        pane = PANE_COVER;
+        return ui_message(step ? "Marking every executed instruction." : "Marking profiler samples.");
+    }
+    if(strcmp(word, "off") == 0)
+    {
+        cover.stepping = false;
+        cover.sampling = false;
+        if(cover_prof) prof.stop();
+        cover_prof = false;
+        return update_run_state();
+    }
+    if(strcmp(word, "reset") == 0)
+    {
+        cover.reset();
+        cover_live_counted = 0;
+        return;
+    }
+    if(strcmp(word, "save") == 0)
+    {
+        char path[512];
+        coverageset live;
+        cover.snapshot(live);
+        if(!a[0]) strcpy(a, "last");
+        if(!cover_path(path, sizeof(path), a) or !live.save(path)) return ui_message("Could not save coverage \"%s\".", a);
+        return ui_message("Saved %llu covered words as \"%s\".", (unsigned long long)live.count(), a);
+    }
+
+    int op = strcmp(word, "or") == 0 ? COVER_UNION : strcmp(word, "and") == 0 ? COVER_INTERSECT :
+        strcmp(word, "diff") == 0 ? COVER_DIFFERENCE : strcmp(word, "show") == 0 ? -1 : -2;
+    if(op == -2 or !a[0] or (op >= 0 and !b[0]))
+        return ui_message("Usage: cover [on [step|sample]] | off | reset | save [name] | show <run> | or|and|diff <run> <run>");
+    coverageset second;
+    if(!cover_load(a, cover_result) or (op >= 0 and !cover_load(b, second))) return;
+    auto start = SDL_GetPerformanceCounter();
+    if(op >= 0) coverage_combine(cover_result, second, op, cover_result);
+    coverage_ranges(cover_result, cover_ranges);
+    cover_result_count = cover_result.count();
+    double ms = (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+    if(op >= 0) snprintf(cover_title, sizeof(cover_title), "%s %s %s", a, word, b);
+    else snprintf(cover_title, sizeof(cover_title), "%s", a);
+    cover_top = 0;
+    pane = PANE_COVER;
+    ui_message("%s: %llu words in %u ranges (%.2f ms).", cover_title, (unsigned long long)cover_result_count,
+        unsigned(cover_ranges.size()), ms);
+}
+
+void command_calls(const char * args)
+{
+    char word[16] = "";
+    sscanf(args, "%15s", word);
+    if(strcmp(word, "off") == 0)
+    {
+        calls.enabled = false;
+        return update_run_state();
+    }
+    if(strcmp(word, "reset") == 0) return (void)(calls.reset_requested = true);
+    if(word[0] and strcmp(word, "on") != 0) return ui_message("Usage: calls [on] | off | reset");
+    if(!debugger_enabled) return ui_message("The call stack needs the core's debugger (setting \"debugger\").");
+    // calls made before now are unknown, so start from an empty stack
+    calls.reset_requested = true;
+    calls.enabled = true;
+    update_run_state();
+    pane = PANE_CALLS;
+}
+
+void command_reverse(const char * args)
+{
+    char word[16] = "";
+    sscanf(args, "%15s", word);
+    if(strcmp(word, "off") == 0)
+    {
+        rev.stop();
+        return update_run_state();
+    }
+    if(word[0] and strcmp(word, "on") != 0)
+        return ui_message("Usage: reverse [on] | off, then back (sb) and rc");
+    if(!debugger_enabled) return ui_message("Reverse stepping needs the core's debugger (setting \"debugger\").");
+    m64p_handle coreconf;
+    if(ConfigOpenSection("Core", &coreconf) != M64ERR_SUCCESS or ConfigGetParamInt(coreconf, "R4300Emulator") != 0)
+        return ui_message("Reverse stepping needs the pure interpreter; set \"reverse\" to 1 and restart.");
+    rev.start();
+    update_run_state();
+    ui_message("Recording history for reverse stepping.");
+}
+
+void command_rewind(const char * args)
+{
+    char word[16] = "";
+    sscanf(args, "%15s", word);
+    if(strcmp(word, "off") == 0) return rewinder_stop();
+    if(strcmp(word, "on") == 0)
+    {
+        if(rewinder_active()) return;
+        if(rewinder_start(rewind_config) != 0) return ui_message("Could not start the rewind buffer.");
+        return ui_message("Keeping a state every %u frames in %u MB for rewinding.", rewind_config.every, rewind_config.budget_mb);
+    }
+    if(!rewinder_active()) return ui_message("The rewind buffer is off (\"rewind on\").");
+    if(!word[0])
+    {
+        return ui_message("Rewind: %u states over %.1f s, %llu of %u MB, %u KB per state unpacked, %u late, %u lost.",
+            rewindstats.states.load(), (rewindstats.newest - rewindstats.oldest) / rewind_config.fps,
+            (unsigned long long)rewindstats.bytes.load() >> 20, rewind_config.budget_mb,
+            unsigned(rewindstats.state_bytes >> 10), rewindstats.late.load(), rewindstats.lost.load());
+    }
+    char * end;
+    double seconds = strtod(word, &end);
+    if(*end or seconds < 0) return ui_message("Usage: rewind [seconds] | on | off");
+    if(!rewinder_back(seconds)) ui_message("Still loading the last rewind.");
+}
+
+// back one instruction, or back to the last breakpoint hit
+void reverse_step(bool to_breakpoint)
+{
+    if(!rev.enabled) return ui_message("Reverse stepping is off (\"reverse on\").");
+    if(!breaks.stopped) return ui_message("Pause first.");
+    bool run = to_breakpoint ? rev.reverse_continue() : rev.step_back();
+    if(rev.error[0]) ui_message("Reverse: %s.", rev.error);
+    if(run) breaks.replay();
+}
+
+void command_profile(const char * args)
+{
+    char word[16] = "", arg[256] = "";
+    sscanf(args, "%15s %255s", word, arg);
+    if(strcmp(word, "off") == 0)
+    {
+        prof.stop();
+        return ui_message("Profiler stopped at %llu samples.", (unsigned long long)prof.samples.load());
+    }
+    if(strcmp(word, "reset") == 0) return prof.reset();
+    if(strcmp(word, "write") == 0)
+    {
+        if(!arg[0]) strcpy(arg, "profile.txt");
+        if(!prof.write(arg)) return ui_message("Could not write %s.", arg);
+        return ui_message("Profile written to %s.", arg);
+    }
+    const char * usage = "Usage: profile [on [rate|frame]] | off | reset | write [path]";
+    if(word[0] and strcmp(word, "on") != 0) return ui_message(usage);
+    // default 1000 Hz; "frame" samples once per frame from the emulation thread instead of a thread
+    uint32_t rate = 1000;
+    if(strcmp(arg, "frame") == 0) rate = 0;
+    else if(arg[0])
+    {
+        char * end;
+        rate = strtoul(arg, &end, 10);
+        if(*end or rate == 0) return ui_message(usage);
+    }
+    if(!prof.start(rate, prof_shift)) return ui_message("Could not start the profiler.");
+    // the user's now, so "cover off" leaves it running
+    cover_prof = false;
+    m64p_handle coreconf;
+    if(ConfigOpenSection("Core", &coreconf) == M64ERR_SUCCESS and ConfigGetParamInt(coreconf, "R4300Emulator") != 0)
+        ui_message("Not the pure interpreter (Core R4300Emulator 0): the PC only moves by block, so samples are coarse.");
+    pane = PANE_PROFILE;
+}
+
+void stop_emulator()
+{
+    // a paused core sits in the debugger and wouldn't see the stop
+    if(breaks.hold) breaks.resume();
+    CoreDoCommand(M64CMD_STOP, 0, NULL);
+}
+
+// Disassembly around the PC, or wherever it was scrolled to.
+disasmcache disasm;
+struct {
+    bool follow = true; // keep the PC in view
+    uint32_t top = 0x80000400;
+    int rows = 0;
+} disview;
+
+uint32_t current_pc()
+{
+    if(breaks.stopped) return breaks.stop_pc;
+    // outside the pure interpreter the core hands out the current precompiled instruction's address
+    // field, which moves on, so the pointer is asked for every time
+    auto pc = (const uint32_t *) DebugGetCPUDataPtr(M64P_CPU_PC);
+    return pc ? *pc : 0;
+}
+
+void draw_disasm(int top, int bottom)
+{
+    int rows = bottom - top - 1;
+    disview.rows = rows;
+    if(rows <= 0) return;
+    uint32_t pc = current_pc();
+    // re-centre only when the PC leaves the middle of the view, so stepping doesn't scroll every line
+    if(disview.follow and (pc < disview.top + 4*(rows/4) or pc >= disview.top + 4*(rows - rows/4)))
+        disview.top = pc - 4*(rows/3);
+    
+    int y = top;
+    screen.at(y++, 0);
+    screen.format("Disassembly%s, PC %08X (%llu decoded, %llu cached)", disview.follow ? " following" : "", pc,
+        (unsigned long long)disasm.misses, (unsigned long long)disasm.hits);
+    for(int r = 0; r < rows; r++)
+    {
+        uint32_t addr = disview.top + 4*r;
+        auto & line = disasm.decode(rdram(), addr);
+        bool marked = false;
+        for(auto & point : breaks.points)
+            if((point.range.flags & M64P_BKP_FLAG_EXEC) and addr >= point.range.address and addr <= point.range.endaddr)
+                marked = true;
+        screen.at(y++, 0);
+        screen.style(addr == pc ? COLOR_PAIR(2) | A_REVERSE : COLOR_PAIR(2));
+        screen.format("%c%08X %08X  %-8s %s", marked ? '*' : ' ', addr, line.word, line.op, line.args);
+        screen.style(COLOR_PAIR(2));
+    }
+}
+
+void scroll_disasm(int64_t lines)
+{
+    disview.follow = false;
+    disview.top += uint32_t(lines * 4);
+}
+
+void run_command(const char * line)
+{
+    char name[32] = "";
+    int used = 0;
+    if(sscanf(line, " %31s %n", name, &used) < 1) return;
+    if(strcmp(name, "scan") == 0) return pane = PANE_SCAN, command_scan(line+used);
+    if(strcmp(name, "heat") == 0) return command_heat(line+used);
+    if(strcmp(name, "hex") == 0)
+    {
+        pane = PANE_HEX;
+        if(line[used]) hexview.top = 0, scroll_hex(strtoul(line+used, nullptr, 16));
+        return;
+    }
+    if(strcmp(name, "break") == 0 or strcmp(name, "b") == 0) return command_break(line+used);
+    if(strcmp(name, "delete") == 0)
+    {
+        int index = parse_breakpoint(line+used);
+        if(index >= 0) breaks.remove(index);
+        return;
+    }
+    if(strcmp(name, "enable") == 0 or strcmp(name, "disable") == 0)
+    {
+        int index = parse_breakpoint(line+used);
+        if(index >= 0) breaks.enable(index, name[0] == 'e');
+        return;
+    }
+    if(strcmp(name, "record") == 0) return command_record(line+used);
+    if(strcmp(name, "profile") == 0) return command_profile(line+used);
+    if(strcmp(name, "trace") == 0) return command_trace(line+used);
+    if(strcmp(name, "cover") == 0) return command_cover(line+used);
+    if(strcmp(name, "calls") == 0) return command_calls(line+used);
+    if(strcmp(name, "reverse") == 0) return command_reverse(line+used);
+    if(strcmp(name, "rewind") == 0) return command_rewind(line+used);
+    if(strcmp(name, "back") == 0 or strcmp(name, "sb") == 0) return reverse_step(false);
+    if(strcmp(name, "rc") == 0) return reverse_step(true);
+    if(strcmp(name, "dis") == 0)
+    {
+        pane = PANE_DISASM;
+        disview.follow = !line[used];
+        if(line[used]) disview.top = strtoul(line+used, nullptr, 16) & ~3u;
+        return;
+    }
+    if(strcmp(name, "pause") == 0) return breaks.pause();
+    if(strcmp(name, "step") == 0 or strcmp(name, "s") == 0) return breaks.step();
+    if(strcmp(name, "cont") == 0 or strcmp(name, "c") == 0) return breaks.resume();
+    if(strcmp(name, "q") == 0 or strcmp(name, "quit") == 0) return stop_emulator();
+    ui_message("Unknown command \"%s\".", name);
+}
+
+// heatmap of RDRAM write frequency: each cell covers an equal slice of RDRAM, darker to brighter
+// with heat.lock held, so counts and granularity stay as they are
+void draw_heat_counts(int y, int bottom, int width)
+{
+    static const char ramp[] = " .:-=+*#%@";
+    uint32_t frames = heat.frames, blocks = heat.counts.size();
+    screen.format("Heatmap %uB blocks: %u frames, %.2fms/frame", heat.granularity, frames, heat.last_ms);
+    
+    int hot_rows = 5;
+    int rows = bottom - y - hot_rows - 1;
+    int cols = width - 9;
+    if(rows < 1 or cols < 1 or frames == 0 or blocks != RDRAM_SIZE/heat.granularity) return;
+    uint32_t cells = rows*cols;
+    uint32_t per_cell = (blocks + cells - 1) / cells;
+    rows = (blocks + per_cell*cols - 1) / (per_cell*cols);
+    auto counts = heat.counts.data();
+    for(int r = 0; r < rows; r++)
+    {
+        uint32_t first = r*cols*per_cell;
+        screen.at(y++, 0);
+        screen.format("%08X ", 0x80000000 + first*heat.granularity);
+        for(int c = 0; c < cols and first + c*per_cell < blocks; c++)
+        {
+            uint64_t sum = 0;
+            uint32_t b = first + c*per_cell;
+            for(uint32_t i = b; i < b+per_cell and i < blocks; i++)
+                sum += counts[i];
+            double rate = double(sum) / (double(per_cell) * frames);
+            // square root spreads out the low end, where almost all of RAM sits
+            int level = sum == 0 ? 0 : 1 + int(sqrt(rate) * 8.99);
+            screen.put(ramp[level > 9 ? 9 : level]);
+        }
+    }
+    
+    // hottest single blocks
+    std::vector<uint32_t> hottest;
+    for(uint32_t i = 0; i < blocks; i++)
+    {
+        if(counts[i] == 0) continue;
+        if(hottest.size() < size_t(hot_rows) or counts[i] > counts[hottest.back()])
+        {
+            if(hottest.size() == size_t(hot_rows)) hottest.pop_back();
+            auto at = std::upper_bound(hottest.begin(), hottest.end(), i, [&](uint32_t a, uint32_t b) { return counts[a] > counts[b]; });
+            hottest.insert(at, i);
+        }
+    }
+    y++;
+    for(auto i : hottest)
+    {
+        screen.at(y++, 0);
+        screen.format("0x%08X : %u/%u frames", 0x80000000 + i*heat.granularity, counts[i], frames);
+    }
+}
+
+void draw_heat(int top, int bottom, int width)
+{
+    int y = top;
+    screen.at(y++, 0);
+    if(!heat.enabled) return screen.text("Heatmap off (\"heat on\").");
+    SDL_LockMutex(heat.lock);
+    draw_heat_counts(y, bottom, width);
+    SDL_UnlockMutex(heat.lock);
+}
+
+void draw_break(int top, int bottom)
+{
+    int y = top;
+    screen.at(y++, 0);
+    screen.format("Breakpoints: %u, %llu stops resumed", unsigned(breaks.points.size()), (unsigned long long)breaks.resumed);
+    if(breaks.stopped)
+    {
+        screen.at(y++, 0);
+        if(breaks.stop_index >= 0) screen.format("Stopped by #%d at %08X", breaks.stop_index, breaks.stop_pc);
+        else screen.format("Paused at %08X", breaks.stop_pc);
+    }
+    if(tracer_active())
+    {
+        screen.at(y++, 0);
+        screen.format("Tracing: %llu instructions, %lluK", (unsigned long long)tracestats.instructions.load(),
+            (unsigned long long)tracestats.bytes.load()/1024);
+    }
+    if(rev.enabled)
+    {
+        screen.at(y++, 0);
+        screen.format("Reverse: instruction %llu, %u checkpoints every %llu, %lluM", (unsigned long long)rev.next.load(),
+            rev.checkpoint_count.load(), (unsigned long long)rev.spacing.load(),
+            (unsigned long long)rev.pages_used.load() * REVERSE_PAGE_BYTES >> 20);
+    }
+    for(size_t i = 0; i < breaks.points.size() and y < bottom; i++)
+    {
+        auto & point = breaks.points[i];
+        auto flags = point.range.flags;
+        screen.at(y++, 0);
+        screen.style(flags & M64P_BKP_FLAG_ENABLED ? COLOR_PAIR(2) : COLOR_PAIR(2) | A_DIM);
+        screen.format("%2d %c%c%c %08X", int(i), flags & M64P_BKP_FLAG_READ ? 'r' : '-', flags & M64P_BKP_FLAG_WRITE ? 'w' : '-',
+            flags & M64P_BKP_FLAG_EXEC ? 'x' : '-', point.range.address);
+        if(point.range.endaddr != point.range.address) screen.format("-%08X", point.range.endaddr);
+        screen.format(" %u/%u", point.hits, point.checks);
+        if(point.source[0]) screen.format(" if %s", point.source);
+        screen.style(COLOR_PAIR(2));
+    }
+}
+
+// Per-watch history for the chart pane, fed from every frame the UI drains.
+std::vector<sparkhistory> sparks;
+// spans the chart pane can show, in frames
+const uint32_t chart_spans[] = {60, 300, 1800, 3600, 18000, 36000};
+const char * chart_span_names[] = {"1s", "5s", "30s", "1m", "5m", "10m"};
+int chart_zoom = 2;
+size_t chart_pick = 0; // watch drawn large
+
+float watch_float(uint32_t mode, uint32_t value)
+{
+    if(mode == float_)
+    {
+        float f;
+        memcpy(&f, &value, 4);
+        return f;
+    }
+    if(mode == s8_) return int8_t(value);
+    if(mode == s16_) return int16_t(value);
+    if(mode == s32_) return int32_t(value);
+    return value;
+}
+
+// One sparkline per watch, on the same row as the watch, then a larger chart of the picked one.
+// Sparklines use the curses scan-line glyphs as five heights and a bar where a column's min and
+// max land on different heights.
+void draw_chart(int top, int bottom, int width)
+{
+    static const chtype heights[] = {ACS_S9, ACS_S7, ACS_HLINE, ACS_S3, ACS_S1};
+    uint32_t span = chart_spans[chart_zoom];
+    int y = top;
+    screen.at(y++, 0);
+    screen.format("Last %s (+/- zoom, </> pick)", chart_span_names[chart_zoom]);
+    int cols = width - 2;
+    if(cols < 4 or sparks.size() != watch.entries.size()) return;
+    std::vector<sparkbucket> slices(cols);
+    
+    for(size_t i = 0; i < sparks.size() and y < bottom; i++)
+    {
+        sparks[i].columns(span, cols, slices.data());
+        float lo = INFINITY, hi = -INFINITY;
+        for(auto & b : slices)
+            if(b.lo <= b.hi) lo = fminf(lo, b.lo), hi = fmaxf(hi, b.hi);
+        screen.at(y++, 0);
+        screen.put(i == chart_pick ? '>' : ' ');
+        for(auto & b : slices)
+        {
+            if(b.lo > b.hi or !(hi >= lo))
+            {
+                screen.put(' ');
+                continue;
+            }
+            float scale = hi > lo ? 4.999f / (hi - lo) : 0;
+            int a = (b.lo - lo) * scale, z = (b.hi - lo) * scale;
+            screen.put(a == z ? heights[a] : ACS_VLINE);
+        }
+    }
+    
+    // the picked watch, with its range on the left
+    int rows = bottom - y - 1;
+    if(chart_pick >= sparks.size() or rows < 3) return;
+    int label = 10;
+    cols = width - label - 1;
+    if(cols < 4) return;
+    slices.resize(cols);
+    sparks[chart_pick].columns(span, cols, slices.data());
+    float lo = INFINITY, hi = -INFINITY;
+    for(auto & b : slices)
+        if(b.lo <= b.hi) lo = fminf(lo, b.lo), hi = fmaxf(hi, b.hi);
+    y++;
+    if(!(hi >= lo)) return;
+    for(int r = 0; r < rows; r++)
+    {
+        // row r covers values from its bottom edge up
+        float row_hi = hi - (hi - lo) * r / rows, row_lo = hi - (hi - lo) * (r+1) / rows;
+        screen.at(y + r, 0);
+        if(r == 0) screen.format("%9.4g ", hi);
+        else if(r == rows-1) screen.format("%9.4g ", lo);
+        else screen.format("%*s", label, "");
+        for(auto & b : slices)
+        {
+            bool hit = b.lo <= b.hi and b.hi >= row_lo and b.lo <= row_hi;
+            // a flat series still gets one row
+            if(hi == lo) hit = b.lo <= b.hi and r == rows-1;
+            screen.put(hit ? ACS_CKBOARD : ' ');
+        }
+    }
+}
+
+// hottest PC buckets on the left, hottest return addresses on the right
+void draw_profile(int top, int bottom, int width)
+{
+    int y = top;
+    screen.at(y++, 0);
+    uint64_t total = prof.samples;
+    screen.format("Profile: %llu samples", (unsigned long long)total);
+    if(prof.running) screen.format(prof.rate ? " at %u Hz" : " per frame", prof.rate);
+    else screen.text(" (\"profile on\")");
+    if(prof.outside) screen.format(", %llu outside RDRAM", (unsigned long long)prof.outside.load());
+    if(prof.pc_counts.empty() or total == 0) return;
+    
+    int rows = bottom - y - 1;
+    if(rows <= 0) return;
+    int half = width / 2;
+    screen.at(y, 0);
+    screen.text("PC");
+    screen.at(y++, half);
+    screen.text("RA (callers)");
+    std::vector<hotspot> pcs, ras;
+    prof.hottest(false, rows, pcs);
+    prof.hottest(true, rows, ras);
+    for(int r = 0; r < rows; r++)
+    {
+        if(size_t(r) < pcs.size())
+        {
+            auto & line = disasm.decode(rdram(), pcs[r].addr);
+            screen.at(y + r, 0);
+            screen.format("%08X %5.1f%% %s %s", pcs[r].addr, 100.0 * pcs[r].count / total, line.op, line.args);
+        }
+        if(size_t(r) < ras.size())
+        {
+            screen.at(y + r, half);
+            screen.format("%08X %5.1f%%", ras[r].addr, 100.0 * ras[r].count / total);
+        }
+    }
+}
+
+// the live coverage, then the ranges of the last "cover" query
+void draw_cover(int top, int bottom)
+{
+    int y = top;
+    screen.at(y++, 0);
+    // a count is a pass over the whole bitmap; the pane redraws far more often than that is worth
+    if(SDL_GetTicks() - cover_live_counted >= 1000 or !cover_live_counted)
+    {
+        cover_live_count = cover.count();
+        cover_live_counted = SDL_GetTicks() | 1;
+    }
+    screen.format("Coverage: %llu words", (unsigned long long)cover_live_count);
+    screen.text(cover.stepping ? ", every instruction" : cover.sampling ? ", sampled" : " (\"cover on\")");
+    if(!cover_title[0]) return;
+    screen.at(y++, 0);
+    screen.format("%s: %llu words in %u ranges", cover_title, (unsigned long long)cover_result_count, unsigned(cover_ranges.size()));
+    if(cover_top >= cover_ranges.size()) cover_top = 0;
+    for(size_t i = cover_top; i < cover_ranges.size() and y < bottom; i++)
+    {
+        auto & r = cover_ranges[i];
+        auto & line = disasm.decode(rdram(), r.addr);
+        screen.at(y++, 0);
+        screen.format("%08X-%08X %6u %s %s", r.addr, r.addr + r.words*4 - 1, r.words, line.op, line.args);
+    }
+}
+
+// backtrace, innermost call first, over the functions with the most inclusive time
+void draw_calls(int top, int bottom)
+{
+    int y = top;
+    screen.at(y++, 0);
+    uint64_t steps = calls.steps;
+    screen.format("Calls: %llu instructions, %u functions", (unsigned long long)steps, calls.function_count.load());
+    if(!calls.enabled) screen.text(" (\"calls on\")");
+    if(steps == 0) return;
+    
+    static callframe frames[CALLSTACK_DEPTH];
+    int depth = calls.backtrace(frames, CALLSTACK_DEPTH);
+    // the stack gets at most half the pane; the outermost calls are the ones left out
+    int shown = std::min(depth, (bottom - y) / 2 - 1);
+    screen.at(y++, 0);
+    screen.format("Backtrace: %d deep%s", depth, calls.lost ? " (overflowed)" : "");
+    for(int i = depth - 1; i >= depth - shown; i--)
+    {
+        screen.at(y++, 0);
+        screen.format("#%-3d %08X  returns to %08X  %llu instructions ago", depth - 1 - i, frames[i].entry, frames[i].ret,
+            (unsigned long long)(steps - frames[i].start));
+    }
+    
+    std::vector<int> order;
+    for(int i = 0; i < CALLSTACK_FUNCTIONS; i++)
+        if(calls.functions[i].entry) order.push_back(i);
+    int rows = std::min(int(order.size()), bottom - y - 1);
+    if(rows <= 0) return;
+    auto inclusive = [](int i) { return calls.functions[i].inclusive.load(); };
+    std::partial_sort(order.begin(), order.begin() + rows, order.end(), [&](int a, int b) { return inclusive(a) > inclusive(b); });
+    screen.at(y++, 0);
+    screen.text("Function    calls   incl%  self%");
+    for(int r = 0; r < rows; r++)
+    {
+        auto & f = calls.functions[order[r]];
+        screen.at(y++, 0);
+        screen.format("%08X %8llu %6.1f %6.1f", f.entry.load(), (unsigned long long)f.calls.load(),
+            100.0 * f.inclusive / steps, 100.0 * f.self / steps);
+    }
+}
+
+// ':' opens a command line on the message title bar
+bool typing = false;
+std::string command;
+
+void handle_key(int key)
+{
+    if(typing)
+    {
+        if(key == '\n' or key == '\r' or key == KEY_ENTER)
+        {
+            typing = false;
+            run_command(command.data());
+            command.clear();
+        }
+        else if(key == 27) // escape
+            typing = false, command.clear();
+        else if(key == KEY_BACKSPACE or key == 127 or key == 8)
+        {
+            if(!command.empty()) command.pop_back();
+        }
+        else if(key >= 32 and key < 127)
+            command.push_back(key);
+        return;
+    }
+    if(key == ':')
+        typing = true;
+    if(key >= '0' and key <= '9')
+        pane = key - '0';
+    if(pane == PANE_DISASM)
+    {
+        int page = disview.rows > 1 ? disview.rows - 1 : 1;
+        if(key == KEY_UP) scroll_disasm(-1);
+        if(key == KEY_DOWN) scroll_disasm(1);
+        if(key == KEY_PPAGE) scroll_disasm(-page);
+        if(key == KEY_NPAGE) scroll_disasm(page);
+        if(key == KEY_HOME) disview.follow = true;
+    }
+    if(pane == PANE_CHART)
+    {
+        int spans = sizeof(chart_spans)/sizeof(chart_spans[0]);
+        if((key == '+' or key == '=') and chart_zoom > 0) chart_zoom--;
+        if(key == '-' and chart_zoom < spans-1) chart_zoom++;
+        if(key == '<' and chart_pick > 0) chart_pick--;
+        if(key == '>' and chart_pick+1 < watch.entries.size()) chart_pick++;
+    }
+    if(pane == PANE_COVER)
+    {
+        if(key == KEY_UP and cover_top > 0) cover_top--;
+        if(key == KEY_DOWN and cover_top+1 < cover_ranges.size()) cover_top++;
+        if(key == KEY_PPAGE) cover_top = cover_top > 10 ? cover_top - 10 : 0;
+        if(key == KEY_NPAGE and cover_top+10 < cover_ranges.size()) cover_top += 10;
+    }
+    if(pane == PANE_HEX)
+    {
+        int page = hexview.rows > 1 ? hexview.rows - 1 : 1;
+        if(key == KEY_UP) scroll_hex(-16);
+        if(key == KEY_DOWN) scroll_hex(16);
+        if(key == KEY_PPAGE) scroll_hex(-16*page);
+        if(key == KEY_NPAGE) scroll_hex(16*page);
+        if(key == KEY_HOME) scroll_hex(-int64_t(RDRAM_SIZE));
+        if(key == KEY_END) scroll_hex(RDRAM_SIZE);
+    }
+    if(key == 'p')
+        breaks.hold ? breaks.resume() : breaks.pause();
+    if(key == 's')
+        breaks.step();
+    if(key == 'b')
+        reverse_step(false);
+    if(key == 'q')
+        stop_emulator();
+}
+
 int runui(void * unused)
 {
-    enum {
-        int_,
-        float_,
-        char_
-    };
-    struct watchlist_entry {
-        uint32_t addr;
-        uint32_t mode;
-    };
-    
-    std::vector<watchlist_entry> watchlist;
-    watchlist.push_back({0x802245B0+8   , float_});
-    watchlist.push_back({0x802245B0+8+4 , float_});
-    watchlist.push_back({0x802245B0+8+8 , float_});
-    watchlist.push_back({0x802245B0+0x44, int_});
-    watchlist.push_back({0x80200000     , char_});
+    auto & watchlist = watch.entries;
+    // the ring only holds frames until the UI catches up; the newest one is what gets drawn
+    std::vector<uint32_t> latest(watch.stride());
+    bool sampled = false;
+    uint32_t latest_frame = 0;
+    std::vector<uint32_t> row(watchlist.size());
+    sparks.resize(watchlist.size());
+    
+    // log writer throughput, averaged over a second
+    uint64_t log_records = 0;
+    auto log_ticks = SDL_GetTicks();
+    double log_rate = 0;
+    
+    // copy of msglog, so a frame that can't get the lock still has something to draw
+    std::vector<std::string> shown_log;
     
     real_print = print_curses;
     char str[] = "0x80123456 : 00000000";
     uint32_t len_str = sizeof(str)-1;
     puts("Got here.");
+    nodelay(stdscr, TRUE);
+    keypad(stdscr, TRUE);
+    Uint32 min_interval = ui_max_fps > 0 ? 1000 / ui_max_fps : 0;
     while(1)
     {
         if(!emulating)
@@ -354,34 +1726,84 @@ int runui(void * unused)
             break;
         }
         
-        clear();
-        int y, x, h, w;
-        getmaxyx(stdscr, h, w);
+        for(int key; (key = getch()) != ERR; )
+            handle_key(key);
+        update_scan();
+        
+        screen.begin();
+        int y, x, h = screen.h, w = screen.w;
         
-        #define TITLEBAR(_y, text) move(_y, 0); attron(COLOR_PAIR(1)); hline(ACS_HLINE, w); attron(COLOR_PAIR(3)); printw(" " text " "); attron(COLOR_PAIR(2));
+        #define TITLEBAR(_y, title) screen.at(_y, 0); screen.style(COLOR_PAIR(1)); screen.fill(ACS_HLINE, w); screen.style(COLOR_PAIR(3)); screen.text(" " title " "); screen.style(COLOR_PAIR(2));
         TITLEBAR(0, "Debugger")
+        if(breaks.stopped)
+        {
+            screen.style(COLOR_PAIR(3));
+            screen.format("- paused at %08X ", breaks.stop_pc);
+            screen.style(COLOR_PAIR(2));
+        }
+        
+        // left pane, kept clear of the watchlist column
+        screen.limit(w - len_str - 2);
+        if(pane == PANE_SCAN) draw_scan(1, h - msglog_height - 1);
+        if(pane == PANE_HEAT) draw_heat(1, h - msglog_height - 1, w - len_str - 2);
+        if(pane == PANE_HEX) draw_hex(1, h - msglog_height - 1);
+        if(pane == PANE_BREAK) draw_break(1, h - msglog_height - 1);
+        if(pane == PANE_CHART) draw_chart(1, h - msglog_height - 1, w - len_str - 2);
+        if(pane == PANE_DISASM) draw_disasm(1, h - msglog_height - 1);
+        if(pane == PANE_PROFILE) draw_profile(1, h - msglog_height - 1, w - len_str - 2);
+        if(pane == PANE_COVER) draw_cover(1, h - msglog_height - 1);
+        if(pane == PANE_CALLS) draw_calls(1, h - msglog_height - 1);
+        screen.limit(w);
         
         y = 1;
         x = w-len_str-1;
-        move(y++, x);
-        printw("Watchlist:");
-        for(auto e : watchlist)
+        screen.at(y++, x);
+        while(auto record = frames.peek(&latest_frame))
         {
-            if(e.mode == int_)
+            watch.values(record, row.data());
+            for(size_t i = 0; i < sparks.size(); i++)
+                sparks[i].push(watch_float(watchlist[i].mode, row[i]));
+            std::copy(record, record + watch.stride(), latest.begin());
+            frames.pop();
+            sampled = true;
+        }
+        watch.view(sampled ? latest.data() : nullptr);
+        screen.format("Watchlist: %u", latest_frame);
+        if(recorder_active())
+            screen.format(" rec %lluK", (unsigned long long)recordstats.bytes.load()/1024);
+        for(size_t i = 0; i < watchlist.size(); i++)
+        {
+            auto e = watchlist[i];
+            // entries behind pointers show where the chain led this frame
+            e.addr = watch.address(i);
+            if(sampled and e.addr == 0 and e.chain >= 0)
+                snprintf(str, len_str+1, "(null)     : --------");
+            else if(e.mode == u8_ or e.mode == u16_)
+            {
+                int len = watch_width(e.mode);
+                snprintf(str, len_str+1, "0x%08X : %-8.*X", e.addr, len*2, watch.read(i, len));
+            }
+            else if(e.mode == s8_ or e.mode == s16_ or e.mode == s32_)
+            {
+                int len = watch_width(e.mode);
+                int32_t value = int32_t(watch.read(i, len) << (32 - 8*len)) >> (32 - 8*len);
+                snprintf(str, len_str+1, "0x%08X : %-8d", e.addr, value);
+            }
+            else if(e.mode == int_)
             {
-                uint32_t value = DebugMemRead32(e.addr);
+                uint32_t value = watch.read(i);
                 snprintf(str, len_str+1, "0x%08X : %08X", e.addr, value);
             }
-            if(e.mode == char_)
+            else if(e.mode == char_)
             {
-                char * base = (char *) DebugMemGetPointer(M64P_DBG_PTR_RDRAM);
-                if(base == nullptr) continue;
+                if(!sampled) continue;
                 sprintf(str, "0x%08X : ", e.addr);
-                memcpy(str+13, (base+(e.addr&0x00FFFFFF)), 8);
+                for(int b = 0; b < 8; b++)
+                    str[13+b] = watch.byte(i, b);
             }
-            if(e.mode == float_)
+            else if(e.mode == float_)
             {
-                uint32_t value = DebugMemRead32(e.addr);
+                uint32_t value = watch.read(i);
                 float val = *(float*)&value;
                 if(val == 0.0f)
                     sprintf(str, "0x%08X : 00000.00", e.addr);
@@ -412,22 +1834,47 @@ int runui(void * unused)
                         snprintf(str, len_str+1, "0x%08X : %08.2f", e.addr, val);
                 }
             }
-            move(y++, x);
+            screen.at(y++, x);
             print_custom(str, len_str);
         }
         
         if(SDL_TryLockMutex(logmutex) == 0)
         {
-            TITLEBAR(h - msglog_height - 1, "Messages")
-            x = 0;
-            y = h - msglog.size();
-            for(auto s : msglog)
-                mvprintw(y++, x, s.data());
+            shown_log.assign(msglog.begin(), msglog.end());
             SDL_UnlockMutex(logmutex);
         }
-        refresh();
+        TITLEBAR(h - msglog_height - 1, "Messages")
+        screen.format(" %.0f/s, %u dropped ", log_rate, pending_log.dropped.load());
+        if(typing)
+        {
+            screen.at(h - msglog_height - 1, 0);
+            screen.style(A_NORMAL);
+            screen.fill(' ', w);
+            screen.format(":%s", command.data());
+            screen.style(COLOR_PAIR(2));
+        }
+        x = 0;
+        y = h - shown_log.size();
+        for(auto & s : shown_log)
+        {
+            screen.at(y++, x);
+            screen.text(s.data());
+        }
+        screen.present();
+        
+        auto now = SDL_GetTicks();
+        if(now - log_ticks >= 1000)
+        {
+            uint64_t records = logstats.records;
+            log_rate = (records - log_records) * 1000.0 / (now - log_ticks);
+            log_records = records;
+            log_ticks = now;
+        }
         
-        SDL_Delay(16);
+        // rate cap first, then sleep until something happens; the timeout keeps the stats line moving
+        auto since = SDL_GetTicks() - now;
+        if(since < min_interval) SDL_Delay(min_interval - since);
+        ui_wait(fileno(stdin), 1000);
     }
     endwin();
 }
@@ -442,13 +1889,24 @@ int main()
     
     // enter core loop
     if(emulate() != 0) emulating = 0;
+    restore_core_config();
     
     // shutdown
     SDL_WaitThread(uithread, nullptr);
-    SDL_DestroyMutex(logmutex);
     
     fflush(stdout);
     fflush(stderr);
+    prof.stop();
+    tracer_stop();
+    // the session's coverage, to compare the next one against
+    coverageset live;
+    cover.snapshot(live);
+    char cover_file[512];
+    if(live.count() and cover_path(cover_file, sizeof(cover_file), "last")) live.save(cover_file);
+    recorder_stop();
+    rewinder_stop();
+    logwriter_stop();
+    SDL_DestroyMutex(logmutex);
     
     fclose(real_stdout);
     freopen(TERMINAL, "w", stdout);
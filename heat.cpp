@@ -0,0 +1,105 @@
+#include "heat.hpp"
+#include "rdram.hpp"
+
+#include <string.h>
+
+#include <SDL2/SDL.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HEAT_X86
+#endif
+
+rdramdiff::rdramdiff()
+{
+    lock = SDL_CreateMutex();
+}
+
+uint32_t rdramdiff::blocks()
+{
+    return RDRAM_SIZE / granularity;
+}
+
+// changed-word mask for the 16 words at p; bit i set if word i differs from the snapshot
+static uint32_t diff16_scalar(const uint32_t * live, const uint32_t * old)
+{
+    uint32_t mask = 0;
+    for(int i = 0; i < 16; i++)
+        mask |= uint32_t(live[i] != old[i]) << i;
+    return mask;
+}
+
+#ifdef HEAT_X86
+__attribute__((target("avx2")))
+static uint32_t diff16_avx2(const uint32_t * live, const uint32_t * old)
+{
+    auto a0 = _mm256_loadu_si256((const __m256i *)live);
+    auto a1 = _mm256_loadu_si256((const __m256i *)(live+8));
+    auto b0 = _mm256_loadu_si256((const __m256i *)old);
+    auto b1 = _mm256_loadu_si256((const __m256i *)(old+8));
+    auto x0 = _mm256_xor_si256(a0, b0);
+    auto x1 = _mm256_xor_si256(a1, b1);
+    // the common case: nothing in these 64 bytes changed
+    if(_mm256_testz_si256(_mm256_or_si256(x0, x1), _mm256_or_si256(x0, x1))) return 0;
+    auto zero = _mm256_setzero_si256();
+    uint32_t same0 = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(x0, zero)));
+    uint32_t same1 = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(x1, zero)));
+    return ~(same0 | same1 << 8) & 0xFFFF;
+}
+#endif //  HEAT_X86
+
+void rdramdiff::step(const uint32_t * rdram)
+{
+    auto g = requested_granularity.exchange(0);
+    if(reprime_requested.exchange(false)) primed = false;
+    if(reset_requested.exchange(false) or g or counts.size() != blocks())
+    {
+        SDL_LockMutex(lock);
+        if(g)
+        {
+            granularity = g;
+            primed = false;
+        }
+        counts.assign(blocks(), 0);
+        frames = 0;
+        SDL_UnlockMutex(lock);
+    }
+    if(!primed)
+    {
+        snapshot.assign(rdram, rdram + RDRAM_SIZE/4);
+        primed = true;
+        return;
+    }
+    
+    auto start = SDL_GetPerformanceCounter();
+    #ifdef HEAT_X86
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    auto diff16 = avx2 ? diff16_avx2 : diff16_scalar;
+    #else  //  HEAT_X86
+    auto diff16 = diff16_scalar;
+    #endif //  HEAT_X86
+    
+    auto old = snapshot.data();
+    uint32_t words_per_block = granularity / 4;
+    for(uint32_t w = 0; w < RDRAM_SIZE/4; w += 16)
+    {
+        auto mask = diff16(rdram + w, old + w);
+        if(!mask) continue;
+        for(auto m = mask; m; m &= m-1)
+        {
+            int i = __builtin_ctz(m);
+            old[w+i] = rdram[w+i];
+        }
+        if(granularity == 64)
+            counts[w/16]++;
+        else
+        {
+            // one bit per block of this granularity within the 16 words
+            for(uint32_t b = 0; b < 16; b += words_per_block)
+                if(mask >> b & ((1u << words_per_block) - 1))
+                    counts[(w+b)/words_per_block]++;
+        }
+    }
+    frames++;
+    last_ms = (SDL_GetPerformanceCounter()-start)*1000.0/SDL_GetPerformanceFrequency();
+}
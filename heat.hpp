@@ -0,0 +1,30 @@
+#include <stdint.h>
+#include <vector>
+#include <atomic>
+
+#include <SDL2/SDL.h>
+
+// Per-frame RDRAM diff. Once a frame, step() compares live RDRAM against the snapshot from the
+// previous frame and bumps a counter for every block (4, 16 or 64 bytes) that changed, copying only
+// the changed words into the snapshot. Unchanged 64-byte runs cost two vector compares.
+// step() runs on the emulation thread; the UI requests changes through the atomics, which step()
+// applies at the next frame boundary. Replacing counts reallocates it, so step() does that under
+// lock, which the UI holds while it reads counts and granularity; counting itself takes no lock.
+struct rdramdiff {
+    std::vector<uint32_t> snapshot;
+    SDL_mutex * lock;
+    std::vector<uint32_t> counts; // per block of granularity bytes; both change under lock
+    uint32_t granularity = 64;
+    uint32_t frames = 0; // frames accumulated into counts
+    bool primed = false;
+    double last_ms = 0;
+    
+    std::atomic<bool> enabled{false};
+    std::atomic<uint32_t> requested_granularity{0}; // 0 = no change requested
+    std::atomic<bool> reset_requested{false};
+    std::atomic<bool> reprime_requested{false}; // the snapshot is stale, after heat was off
+    
+    rdramdiff();
+    uint32_t blocks();
+    void step(const uint32_t * rdram);
+};
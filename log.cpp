@@ -0,0 +1,408 @@
+#include "log.hpp"
+
+#include <string.h>
+#include <stdio.h>
+#include <vector>
+
+#include <SDL2/SDL.h>
+
+#include "include/m64p_types.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <limits.h>
+#endif //  _WIN32
+
+logring::logring(uint32_t capacity)
+{
+    cells = new cell[capacity];
+    mask = capacity-1;
+    for(uint32_t i = 0; i < capacity; i++)
+        cells[i].seq.store(i, std::memory_order_relaxed);
+}
+
+logring::~logring()
+{
+    delete[] cells;
+}
+
+static void copy_truncated(char * dst, const char * src, size_t size)
+{
+    size_t len = src ? strnlen(src, size-1) : 0;
+    memcpy(dst, src, len);
+    dst[len] = 0;
+}
+
+bool logring::push(const char * ctx, int level, const char * msg)
+{
+    auto pos = head.load(std::memory_order_relaxed);
+    cell * c;
+    while(1)
+    {
+        c = &cells[pos & mask];
+        auto seq = c->seq.load(std::memory_order_acquire);
+        int32_t diff = int32_t(seq - pos);
+        if(diff == 0)
+        {
+            if(head.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed))
+                break;
+        }
+        else if(diff < 0)
+        {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        else
+            pos = head.load(std::memory_order_relaxed);
+    }
+    copy_truncated(c->rec.ctx, ctx, LOG_CTX_SIZE);
+    copy_truncated(c->rec.msg, msg, LOG_MSG_SIZE);
+    c->rec.level = level;
+    c->seq.store(pos+1, std::memory_order_release);
+    return true;
+}
+
+bool logring::pop(logrecord & out)
+{
+    auto pos = tail.load(std::memory_order_relaxed);
+    cell * c;
+    while(1)
+    {
+        c = &cells[pos & mask];
+        auto seq = c->seq.load(std::memory_order_acquire);
+        int32_t diff = int32_t(seq - (pos+1));
+        if(diff == 0)
+        {
+            if(tail.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed))
+                break;
+        }
+        else if(diff < 0)
+            return false;
+        else
+            pos = tail.load(std::memory_order_relaxed);
+    }
+    out = c->rec;
+    c->seq.store(pos+mask+1, std::memory_order_release);
+    return true;
+}
+
+int logfilter::intern(const char * name, int max_level, int rate, int burst)
+{
+    int n = count;
+    for(int i = 0; i < n; i++)
+        if(strcmp(contexts[i].name, name) == 0)
+            return i;
+    if(n == LOG_MAX_CONTEXTS) return LOG_MAX_CONTEXTS-1; // shares the last slot rather than failing
+    auto & c = contexts[n];
+    copy_truncated(c.name, name, LOG_CTX_SIZE);
+    c.max_level = max_level;
+    c.rate = rate;
+    c.burst = burst > 0 ? burst : rate;
+    c.tokens = c.burst;
+    c.refilled = SDL_GetTicks();
+    count = n+1;
+    return n;
+}
+
+static uint32_t hash_message(const char * msg)
+{
+    uint32_t h = 2166136261u;
+    while(*msg) h = (h ^ (unsigned char)*msg++) * 16777619u;
+    return h;
+}
+
+static void report_repeats(logfilter::context & c, logring & ring)
+{
+    if(auto n = c.repeats.exchange(0))
+    {
+        char note[32];
+        snprintf(note, sizeof(note), "x%u", n);
+        ring.push(c.name, M64MSG_STATUS, note);
+    }
+}
+
+static void report_limited(logfilter::context & c, logring & ring)
+{
+    if(auto n = c.limited.exchange(0))
+    {
+        char note[64];
+        snprintf(note, sizeof(note), "%u messages rate-limited", n);
+        ring.push(c.name, M64MSG_WARNING, note);
+    }
+}
+
+bool logfilter::accept(int id, int level, const char * msg, logring & ring)
+{
+    if(id < 0 or id >= count) return true;
+    auto & c = contexts[id];
+    if(level > c.max_level) return false;
+    
+    // same text as the last message from this context: just count it
+    uint32_t now = SDL_GetTicks();
+    c.last_seen.store(now, std::memory_order_relaxed);
+    auto hash = hash_message(msg);
+    if(c.last_hash.exchange(hash, std::memory_order_relaxed) == hash)
+        return c.repeats.fetch_add(1, std::memory_order_relaxed), false;
+    report_repeats(c, ring);
+    
+    if(c.rate == 0) return true;
+    uint32_t then = c.refilled.load(std::memory_order_relaxed);
+    uint32_t earned = uint64_t(now - then) * c.rate / 1000;
+    if(earned > 0 and c.refilled.compare_exchange_strong(then, then + earned * 1000 / c.rate))
+    {
+        int32_t t = c.tokens.load(std::memory_order_relaxed);
+        if(t < 0) t = 0;
+        c.tokens.store(t + int32_t(earned) > c.burst ? c.burst : t + earned, std::memory_order_relaxed);
+        report_limited(c, ring);
+    }
+    if(c.tokens.fetch_sub(1, std::memory_order_relaxed) <= 0)
+        return c.limited.fetch_add(1, std::memory_order_relaxed), false;
+    return true;
+}
+
+void logfilter::flush(logring & ring)
+{
+    uint32_t now = SDL_GetTicks();
+    if(now - flushed < 1000) return;
+    flushed = now;
+    for(int i = 0; i < count; i++)
+    {
+        auto & c = contexts[i];
+        // long runs are reported once a second and keep collapsing
+        report_repeats(c, ring);
+        // after a quiet second, forget the last message so it shows up again if it comes back
+        if(now - c.last_seen.load(std::memory_order_relaxed) >= 1000)
+            c.last_hash.store(0, std::memory_order_relaxed);
+        report_limited(c, ring);
+    }
+}
+
+logwriter_stats logstats;
+
+// records staged per writev; each takes four iovecs (ctx, separator, msg, newline)
+#define STAGE_RECORDS 240
+#define PIPE_CHUNK 4096
+
+static struct {
+    logwriter_config config;
+    logring * ring;
+    void (*display)(const logrecord &);
+    SDL_Thread * thread;
+    SDL_sem * wake;
+    std::atomic<bool> running;
+    FILE * file; // holds the log file open
+    uint64_t file_bytes;
+    int pipe_in; // read end of the stdout pipe, or -1
+} writer;
+
+static void rotate()
+{
+    auto & c = writer.config;
+    fclose(writer.file);
+    char from[4096], to[4096];
+    for(int i = c.keep; i > 0; i--)
+    {
+        if(i > 1) snprintf(from, sizeof(from), "%s.%d", c.path, i-1);
+        else snprintf(from, sizeof(from), "%s", c.path);
+        snprintf(to, sizeof(to), "%s.%d", c.path, i);
+        rename(from, to);
+    }
+    if(c.keep <= 0) remove(c.path);
+    writer.file = fopen(c.path, "w");
+    writer.file_bytes = 0;
+    logstats.rotations++;
+}
+
+#ifndef _WIN32
+
+static void write_batch(struct iovec * iov, int count, size_t total)
+{
+    if(count == 0) return;
+    auto & c = writer.config;
+    if(c.rotate_bytes and writer.file_bytes and writer.file_bytes + total > c.rotate_bytes)
+        rotate();
+    if(!writer.file) return;
+    int fd = fileno(writer.file);
+    // writev may stop short; skip past whatever it did write and continue
+    while(count > 0)
+    {
+        auto done = writev(fd, iov, count);
+        if(done < 0) return;
+        logstats.writes++;
+        logstats.bytes += done;
+        writer.file_bytes += done;
+        while(count > 0 and size_t(done) >= iov->iov_len)
+        {
+            done -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if(count > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + done;
+            iov->iov_len -= done;
+        }
+    }
+}
+
+#else  //  _WIN32
+
+struct iovec {
+    void * iov_base;
+    size_t iov_len;
+};
+
+static void write_batch(struct iovec * iov, int count, size_t total)
+{
+    if(count == 0) return;
+    auto & c = writer.config;
+    if(c.rotate_bytes and writer.file_bytes and writer.file_bytes + total > c.rotate_bytes)
+        rotate();
+    if(!writer.file) return;
+    for(int i = 0; i < count; i++)
+        fwrite(iov[i].iov_base, 1, iov[i].iov_len, writer.file);
+    fflush(writer.file);
+    logstats.writes++;
+    logstats.bytes += total;
+    writer.file_bytes += total;
+}
+
+#endif //  _WIN32
+
+static int writer_thread(void *)
+{
+    static logrecord stage[STAGE_RECORDS];
+    static struct iovec iov[STAGE_RECORDS*4];
+    static char pipebuf[PIPE_CHUNK];
+    static const char sep[] = ": ", nl[] = "\n";
+    
+    uint32_t reported_drops = 0;
+    int staged = 0;
+    size_t staged_bytes = 0;
+    int count = 0;
+    auto oldest = SDL_GetTicks();
+    
+    auto flush = [&]()
+    {
+        write_batch(iov, count, staged_bytes);
+        staged = 0;
+        staged_bytes = 0;
+        count = 0;
+    };
+    
+    // shows rec and adds it to the batch, which never stays full
+    auto stage_one = [&](logrecord * rec)
+    {
+        if(staged == 0) oldest = SDL_GetTicks();
+        writer.display(*rec);
+        size_t ctxlen = strlen(rec->ctx), msglen = strlen(rec->msg);
+        iov[count++] = {rec->ctx, ctxlen};
+        iov[count++] = {(void *)sep, 2};
+        iov[count++] = {rec->msg, msglen};
+        iov[count++] = {(void *)nl, 1};
+        staged_bytes += ctxlen + 2 + msglen + 1;
+        staged++;
+        logstats.records++;
+        if(staged == STAGE_RECORDS or staged_bytes >= writer.config.flush_bytes)
+            flush();
+    };
+    
+    while(1)
+    {
+        bool stopping = !writer.running;
+        SDL_SemWaitTimeout(writer.wake, writer.config.flush_ms);
+        
+        // pipe output (the frontend's own printf) goes out first so it stays ahead of later records
+        #ifndef _WIN32
+        if(writer.pipe_in >= 0)
+        {
+            ssize_t got;
+            while((got = read(writer.pipe_in, pipebuf, sizeof(pipebuf))) > 0)
+            {
+                flush();
+                struct iovec one = {pipebuf, size_t(got)};
+                write_batch(&one, 1, got);
+            }
+        }
+        #endif //  _WIN32
+        
+        if(writer.config.on_wake) writer.config.on_wake();
+        
+        auto drops = writer.ring->dropped.load();
+        if(drops != reported_drops)
+        {
+            // straight into the batch; the queue is the thing that was full
+            logrecord * note = &stage[staged];
+            snprintf(note->ctx, sizeof(note->ctx), "Log");
+            snprintf(note->msg, sizeof(note->msg), "%u messages dropped (log queue full)", drops - reported_drops);
+            note->level = M64MSG_WARNING;
+            stage_one(note);
+            reported_drops = drops;
+        }
+        
+        logrecord * rec;
+        while(staged < STAGE_RECORDS and writer.ring->pop(*(rec = &stage[staged])))
+            stage_one(rec);
+        if(staged and (stopping or SDL_GetTicks() - oldest >= writer.config.flush_ms))
+            flush();
+        
+        if(stopping) break;
+    }
+    flush();
+    return 0;
+}
+
+int logwriter_start(const logwriter_config & config, logring * ring, void (*display)(const logrecord &))
+{
+    writer.config = config;
+    writer.ring = ring;
+    writer.display = display;
+    writer.file_bytes = 0;
+    writer.pipe_in = -1;
+    writer.file = fopen(config.path, "w");
+    if(!writer.file) return -1;
+    
+    #ifndef _WIN32
+    int fds[2];
+    if(pipe(fds) == 0)
+    {
+        fflush(stdout);
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[1]);
+        fcntl(fds[0], F_SETFL, O_NONBLOCK);
+        writer.pipe_in = fds[0];
+    }
+    #else  //  _WIN32
+    freopen(config.path, "a", stdout);
+    #endif //  _WIN32
+    
+    writer.wake = SDL_CreateSemaphore(0);
+    writer.running = true;
+    writer.thread = SDL_CreateThread(writer_thread, "Log Writer", nullptr);
+    if(!writer.thread) return -1;
+    return 0;
+}
+
+void logwriter_stop()
+{
+    if(!writer.thread) return;
+    fflush(stdout);
+    writer.running = false;
+    SDL_SemPost(writer.wake);
+    SDL_WaitThread(writer.thread, nullptr);
+    writer.thread = nullptr;
+    SDL_DestroySemaphore(writer.wake);
+    #ifndef _WIN32
+    // anything printed after this goes straight to the file instead of into a pipe nobody reads
+    if(writer.pipe_in >= 0)
+    {
+        dup2(fileno(writer.file), STDOUT_FILENO);
+        close(writer.pipe_in);
+    }
+    writer.pipe_in = -1;
+    #endif //  _WIN32
+    if(writer.file) fclose(writer.file);
+    writer.file = nullptr;
+}
@@ -0,0 +1,89 @@
+#include <stdint.h>
+#include <atomic>
+
+#define LOG_CTX_SIZE 16
+#define LOG_MSG_SIZE 256
+
+struct logrecord {
+    char ctx[LOG_CTX_SIZE];
+    char msg[LOG_MSG_SIZE]; // truncated to fit, always null-terminated
+    int level;
+};
+
+// Bounded lock-free queue of preallocated log records (Vyukov's sequence-numbered ring).
+// Any number of threads may push and pop concurrently. Pushing copies into a free slot without
+// allocating; when the ring is full the record is counted in dropped and discarded instead of waiting.
+struct logring {
+    struct cell {
+        std::atomic<uint32_t> seq;
+        logrecord rec;
+    };
+    cell * cells = nullptr;
+    uint32_t mask = 0;
+    std::atomic<uint32_t> head{0};
+    std::atomic<uint32_t> tail{0};
+    std::atomic<uint32_t> dropped{0};
+    
+    // capacity must be a power of two
+    logring(uint32_t capacity);
+    ~logring();
+    
+    bool push(const char * ctx, int level, const char * msg);
+    bool pop(logrecord & out);
+};
+
+#define LOG_MAX_CONTEXTS 8
+
+// Filter stage in front of the ring. Message sources are interned to small ids when they register
+// (the id is what they get back as their debug callback context), so the hot-path checks are integer
+// compares on a per-context slot. Each context has a level cutoff, a token bucket, and run-length
+// collapsing of identical consecutive messages, which are reported as "x<count>" once the run ends.
+struct logfilter {
+    struct context {
+        char name[LOG_CTX_SIZE];
+        int max_level;
+        int rate; // messages per second, 0 for unlimited
+        int burst;
+        std::atomic<int32_t> tokens{0};
+        std::atomic<uint32_t> refilled{0};
+        std::atomic<uint32_t> limited{0};
+        std::atomic<uint32_t> last_hash{0};
+        std::atomic<uint32_t> repeats{0};
+        std::atomic<uint32_t> last_seen{0};
+    };
+    context contexts[LOG_MAX_CONTEXTS];
+    std::atomic<int> count{0};
+    uint32_t flushed = 0;
+    
+    // returns the id for name, registering it if needed; not for use on hot paths
+    int intern(const char * name, int max_level, int rate, int burst);
+    // true if the message should go into the ring; may itself push repeat/limit notes
+    bool accept(int id, int level, const char * msg, logring & ring);
+    // reports runs and limit counts that are still pending; call from one thread, as often as convenient
+    void flush(logring & ring);
+};
+
+struct logwriter_config {
+    const char * path = "log.txt";
+    uint32_t flush_bytes = 1<<16; // write out once this much is staged...
+    uint32_t flush_ms = 100;      // ...or once the oldest staged record is this old
+    uint32_t rotate_bytes = 16<<20; // 0 disables rotation
+    int keep = 4; // rotated files kept as path.1 (newest) to path.keep
+    void (*on_wake)() = nullptr; // called on the writer thread every time it wakes
+};
+
+struct logwriter_stats {
+    std::atomic<uint64_t> records{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> writes{0};
+    std::atomic<uint32_t> rotations{0};
+};
+
+// Starts the log writer thread. It is the only consumer of ring: records are passed to display
+// (on the writer thread) and gathered into large writev calls to the log file, which is rotated by size.
+// Where supported, stdout is redirected into a pipe that the writer also drains, so the frontend's own
+// output lands in the same file without per-line syscalls.
+int logwriter_start(const logwriter_config & config, logring * ring, void (*display)(const logrecord &));
+// drains everything still queued and flushes; stdout is pointed at the log file directly afterwards
+void logwriter_stop();
+extern logwriter_stats logstats;
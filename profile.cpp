@@ -0,0 +1,132 @@
+#include "profile.hpp"
+#include "coverage.hpp"
+#include "rdram.hpp"
+
+#include <stdio.h>
+#include <algorithm>
+
+#include "coreapi.h"
+
+#define XM(X) extern ptr_##X X;
+COREAPI
+#undef XM
+
+static int sampler_thread(void * data)
+{
+    auto & p = *(profiler *) data;
+    Uint64 freq = SDL_GetPerformanceFrequency();
+    Uint64 period = freq / p.rate;
+    if(period == 0) period = 1;
+    Uint64 next = SDL_GetPerformanceCounter();
+    while(p.running)
+    {
+        p.sample();
+        next += period;
+        Uint64 now = SDL_GetPerformanceCounter();
+        // after a stall, carry on from now instead of firing a burst of catch-up samples
+        if(now > next + 16*period) next = now;
+        if(next > now)
+        {
+            Uint32 ms = (next - now) * 1000 / freq;
+            if(ms) SDL_Delay(ms);
+        }
+    }
+    return 0;
+}
+
+bool profiler::start(uint32_t rate, uint32_t shift)
+{
+    stop();
+    this->rate = rate;
+    shift = shift < 2 ? 2 : shift > 12 ? 12 : shift;
+    // buckets are only replaced when their size changes; a frame-boundary sample may still be in flight
+    if(shift != this->shift or pc_counts.size() != size_t(RDRAM_SIZE >> shift))
+    {
+        this->shift = shift;
+        std::vector<std::atomic<uint32_t>> pcs(RDRAM_SIZE >> shift), ras(RDRAM_SIZE >> shift);
+        pc_counts.swap(pcs);
+        ra_counts.swap(ras);
+    }
+    reset();
+    if(!regs) regs = (const int64_t *) DebugGetCPUDataPtr(M64P_CPU_REG_REG);
+    running = true;
+    if(rate == 0) return true;
+    thread = SDL_CreateThread(sampler_thread, "Profiler", this);
+    if(!thread) running = false;
+    return thread != nullptr;
+}
+
+void profiler::stop()
+{
+    running = false;
+    if(thread) SDL_WaitThread(thread, nullptr);
+    thread = nullptr;
+}
+
+void profiler::reset()
+{
+    for(auto & c : pc_counts) c.store(0, std::memory_order_relaxed);
+    for(auto & c : ra_counts) c.store(0, std::memory_order_relaxed);
+    samples = 0;
+    outside = 0;
+}
+
+void profiler::sample()
+{
+    if(!running or (skip and *skip)) return;
+    // the cached interpreter answers with the current precompiled instruction's field, so this can't be kept
+    auto pc = (const uint32_t *) DebugGetCPUDataPtr(M64P_CPU_PC);
+    if(!pc) return;
+    uint32_t at = *pc;
+    samples.fetch_add(1, std::memory_order_relaxed);
+    uint32_t phys = rdram_phys(at);
+    if(cover and cover->sampling) cover->mark(at);
+    if(phys == UINT32_MAX)
+    {
+        outside.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    pc_counts[phys >> shift].fetch_add(1, std::memory_order_relaxed);
+    uint32_t ra = regs ? rdram_phys(uint32_t(regs[31])) : UINT32_MAX;
+    if(ra != UINT32_MAX) ra_counts[ra >> shift].fetch_add(1, std::memory_order_relaxed);
+}
+
+void profiler::hottest(bool ra, size_t n, std::vector<hotspot> & out)
+{
+    auto & counts = ra ? ra_counts : pc_counts;
+    out.clear();
+    auto fuller = [](const hotspot & a, const hotspot & b) { return a.count > b.count; };
+    // a min-heap of the best n seen so far; the scan is linear in the bucket count
+    for(size_t i = 0; i < counts.size(); i++)
+    {
+        uint32_t c = counts[i].load(std::memory_order_relaxed);
+        if(c == 0 or (out.size() == n and c <= out.front().count)) continue;
+        if(out.size() == n)
+        {
+            std::pop_heap(out.begin(), out.end(), fuller);
+            out.pop_back();
+        }
+        out.push_back({0x80000000 + uint32_t(i << shift), c});
+        std::push_heap(out.begin(), out.end(), fuller);
+    }
+    std::sort_heap(out.begin(), out.end(), fuller);
+}
+
+bool profiler::write(const char * path)
+{
+    FILE * f = fopen(path, "w");
+    if(!f) return false;
+    uint64_t total = samples;
+    fprintf(f, "# %llu samples, %llu outside RDRAM, %u-byte buckets\n", (unsigned long long)total,
+        (unsigned long long)outside.load(), 1u << shift);
+    std::vector<hotspot> all;
+    for(int ra = 0; ra < 2; ra++)
+    {
+        hottest(ra, pc_counts.size(), all);
+        fprintf(f, ra ? "\n# ra\tsamples\tpercent\n" : "# pc\tsamples\tpercent\n");
+        for(auto & h : all)
+            fprintf(f, "%08X\t%u\t%.3f\n", h.addr, h.count, total ? 100.0 * h.count / total : 0.0);
+    }
+    fclose(f);
+    return true;
+}
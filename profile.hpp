@@ -0,0 +1,43 @@
+#include <stdint.h>
+#include <vector>
+#include <atomic>
+
+#include <SDL2/SDL.h>
+
+struct coverage;
+
+struct hotspot {
+    uint32_t addr; // start of the bucket
+    uint32_t count;
+};
+
+// Statistical profiler for emulated code. Each sample reads the live PC and RA and bumps one counter
+// per histogram, indexed by RDRAM address bucket; counters are relaxed atomics, so the UI reads them
+// while samples land without either side taking a lock. PC samples say where time goes, RA samples
+// which callers it goes through. Samples are taken by a thread at rate Hz, or at every frame
+// boundary (rate 0) by calling sample() from the frame callback. Only the pure interpreter keeps the
+// PC current between instructions; under the cached interpreter and the dynarec it is the address
+// of the last instruction or block the core noted, so samples there are coarser.
+struct profiler {
+    uint32_t shift = 4; // log2 of the bucket size in bytes
+    uint32_t rate = 0;
+    std::vector<std::atomic<uint32_t>> pc_counts;
+    std::vector<std::atomic<uint32_t>> ra_counts;
+    std::atomic<uint64_t> samples{0};
+    std::atomic<uint64_t> outside{0}; // PC wasn't in RDRAM (TLB-mapped code or no CPU yet)
+    std::atomic<bool> running{false};
+    SDL_Thread * thread = nullptr;
+    const int64_t * regs = nullptr;
+    const std::atomic<bool> * skip = nullptr; // no samples while set, e.g. while the debugger holds the CPU
+    coverage * cover = nullptr; // also marks sampled PCs, when its sampling is on
+
+    // allocates buckets and, for rate > 0, starts the sampling thread
+    bool start(uint32_t rate, uint32_t shift);
+    void stop();
+    void reset();
+    void sample();
+    // the n fullest buckets, fullest first
+    void hottest(bool ra, size_t n, std::vector<hotspot> & out);
+    // every nonzero PC bucket, then every nonzero RA bucket, fullest first, with their shares
+    bool write(const char * path);
+};
@@ -0,0 +1,42 @@
+#include <stdint.h>
+
+// The core keeps RDRAM as an array of host-order 32-bit words, so a byte's host position
+// depends on the host's endianness. Everything here works on words to stay endian-neutral.
+
+// expansion pak size; the core always allocates this much
+#define RDRAM_SIZE 0x800000
+
+// xor that turns a host byte/halfword index into the N64 one (and back) for code that walks RDRAM
+// as a plain host array
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define RDRAM_BYTE_SWIZZLE 0
+#define RDRAM_HALF_SWIZZLE 0
+#else
+#define RDRAM_BYTE_SWIZZLE 3
+#define RDRAM_HALF_SWIZZLE 1
+#endif
+
+// physical offset of a KSEG0/KSEG1 address, or UINT32_MAX if it isn't direct-mapped RDRAM
+inline uint32_t rdram_phys(uint32_t addr)
+{
+    if(addr < 0x80000000 or addr >= 0xC0000000) return UINT32_MAX;
+    uint32_t phys = addr & 0x1FFFFFFF;
+    return phys < RDRAM_SIZE ? phys : UINT32_MAX;
+}
+
+// N64 byte at physical offset p of a word array that starts at physical offset base
+inline uint8_t rdram_byte(const uint32_t * words, uint32_t base, uint32_t p)
+{
+    uint32_t rel = p - base;
+    return words[rel >> 2] >> (24 - 8*(rel & 3));
+}
+
+// big-endian value of len (1-4) bytes starting at p, for unaligned reads
+inline uint32_t rdram_read(const uint32_t * words, uint32_t base, uint32_t p, int len)
+{
+    if(len == 4 and ((p - base) & 3) == 0) return words[(p - base) >> 2];
+    uint32_t value = 0;
+    for(int i = 0; i < len; i++)
+        value = value << 8 | rdram_byte(words, base, p+i);
+    return value;
+}
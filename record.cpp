@@ -0,0 +1,131 @@
+#include "record.hpp"
+#include "watch.hpp"
+
+#include <algorithm>
+
+#include <SDL2/SDL.h>
+
+// rows the ring holds between writer passes; several seconds of frames
+#define RECORD_RING 1024
+
+recorder_stats recordstats;
+
+static struct {
+    recorder_config config;
+    columnwriter out;
+    framering ring;
+    SDL_Thread * thread = nullptr;
+    SDL_sem * wake;
+    std::atomic<bool> active{false};
+    std::atomic<uint32_t> pushing{0}; // recorder_push is inside; stop waits for it to leave the ring
+    std::atomic<bool> running{false};
+} recorder;
+
+static bool write_block(std::vector<uint32_t> & block, uint32_t rows)
+{
+    auto & c = recorder.config;
+    if(!recorder.out.write(rows, block.data(), c.block_rows, c.level)) return false;
+    recordstats.blocks++;
+    recordstats.raw_bytes = recorder.out.raw_bytes;
+    recordstats.bytes = recorder.out.offset;
+    return true;
+}
+
+static int recorder_thread(void *)
+{
+    auto & c = recorder.config;
+    uint32_t columns = recorder.out.columns.size();
+    // column-major, so each column of a block is one contiguous run for the packer
+    std::vector<uint32_t> block(size_t(c.block_rows) * columns);
+    uint32_t rows = 0;
+
+    while(1)
+    {
+        bool stopping = !recorder.running;
+        SDL_SemWaitTimeout(recorder.wake, c.flush_ms);
+
+        while(auto row = recorder.ring.peek())
+        {
+            for(uint32_t i = 0; i < columns; i++)
+                block[size_t(i)*c.block_rows + rows] = row[i];
+            recorder.ring.pop();
+            recordstats.rows++;
+            if(++rows == c.block_rows)
+            {
+                write_block(block, rows);
+                rows = 0;
+            }
+        }
+        recordstats.dropped = recorder.ring.dropped.load();
+        if(stopping) break;
+    }
+    if(rows) write_block(block, rows);
+    recorder.out.close();
+    return 0;
+}
+
+int recorder_start(const recorder_config & config, const std::vector<columninfo> & columns)
+{
+    if(recorder.thread) return -1;
+    recorder.config = config;
+    if(recorder.config.block_rows == 0) recorder.config.block_rows = 4096;
+
+    std::vector<columninfo> all;
+    all.push_back({COLUMN_DELTA, "frame"});
+    all.insert(all.end(), columns.begin(), columns.end());
+    if(!recorder.out.open(config.path, all)) return -1;
+
+    recordstats.rows = 0;
+    recordstats.blocks = 0;
+    recordstats.raw_bytes = 0;
+    recordstats.bytes = recorder.out.offset;
+    recordstats.dropped = 0;
+
+    // pushes see active false and leave the ring alone while it is set up
+    recorder.ring.init(RECORD_RING, all.size());
+    recorder.active = true;
+
+    recorder.wake = SDL_CreateSemaphore(0);
+    recorder.running = true;
+    recorder.thread = SDL_CreateThread(recorder_thread, "Recorder", nullptr);
+    if(!recorder.thread)
+    {
+        recorder.active = false;
+        recorder.out.close();
+        return -1;
+    }
+    return 0;
+}
+
+void recorder_push(uint32_t frame, const uint32_t * values)
+{
+    if(!recorder.active) return;
+    // announce the push before checking active again, so that stop either sees it or stops it
+    recorder.pushing++;
+    if(recorder.active)
+        if(auto slot = recorder.ring.reserve())
+        {
+            slot[0] = frame;
+            std::copy(values, values + recorder.ring.stride - 1, slot + 1);
+            recorder.ring.commit(frame);
+        }
+    recorder.pushing--;
+}
+
+void recorder_stop()
+{
+    if(!recorder.thread) return;
+    recorder.active = false;
+    // a push that got past the check finishes its one row
+    while(recorder.pushing) SDL_Delay(0);
+    recorder.running = false;
+    SDL_SemPost(recorder.wake);
+    SDL_WaitThread(recorder.thread, nullptr);
+    recorder.thread = nullptr;
+    SDL_DestroySemaphore(recorder.wake);
+}
+
+bool recorder_active()
+{
+    return recorder.active;
+}
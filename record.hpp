@@ -0,0 +1,32 @@
+#include <stdint.h>
+#include <vector>
+#include <atomic>
+
+#include "column.hpp"
+
+struct recorder_config {
+    const char * path = "record.bac";
+    uint32_t block_rows = 4096; // rows per block; about a minute at 60 frames per second
+    int level = 6; // deflate level
+    uint32_t flush_ms = 250; // how often the writer picks up queued rows
+};
+
+struct recorder_stats {
+    std::atomic<uint64_t> rows{0};
+    std::atomic<uint64_t> blocks{0};
+    std::atomic<uint64_t> raw_bytes{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint32_t> dropped{0};
+};
+
+// Starts recording one row per frame into a columnar file (see column.hpp). columns describes the
+// values handed to recorder_push; the frame number is added in front of them. Rows go through a
+// framering (see watch.hpp), single producer and single consumer, to a writer thread that transposes
+// them into blocks, packs and appends them; recorder_push takes no lock.
+int recorder_start(const recorder_config & config, const std::vector<columninfo> & columns);
+// emulation thread: queues one row of values; dropped (and counted) if the writer has fallen behind
+void recorder_push(uint32_t frame, const uint32_t * values);
+// writes the last partial block and the index
+void recorder_stop();
+bool recorder_active();
+extern recorder_stats recordstats;
@@ -0,0 +1,88 @@
+// recquery: reads a frame recording written by bacui's recorder.
+//   recquery <file>                               lists columns and blocks
+//   recquery <file> <first> <last> [column...]    prints frames first..last, tab separated
+// Columns are picked by number or by the start of their name; all of them by default.
+// Only the blocks covering the range are read, and only the chosen columns are inflated.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "column.hpp"
+
+// watch columns are named "<type> <address>"; the type decides how values print
+static void print_value(const columninfo & column, uint32_t v)
+{
+    auto & name = column.name;
+    if(name.compare(0, 4, "f32 ") == 0 or name.compare(0, 6, "float ") == 0)
+    {
+        float f;
+        memcpy(&f, &v, 4);
+        printf("\t%g", f);
+    }
+    else if(name.compare(0, 3, "s8 ") == 0) printf("\t%d", int8_t(v));
+    else if(name.compare(0, 4, "s16 ") == 0) printf("\t%d", int16_t(v));
+    else if(name.compare(0, 4, "s32 ") == 0) printf("\t%d", int32_t(v));
+    else printf("\t%08X", v);
+}
+
+int main(int argc, char ** argv)
+{
+    if(argc < 2) return puts("Usage: recquery <file> [<first> <last> [column...]]"), 1;
+    columnreader file;
+    if(!file.open(argv[1])) return printf("Can't read %s as a recording.\n", argv[1]), 1;
+
+    if(argc < 4)
+    {
+        uint64_t rows = 0;
+        for(auto & b : file.index) rows += b.rows;
+        printf("%zu columns, %zu blocks, %llu rows", file.columns.size(), file.index.size(), (unsigned long long)rows);
+        if(!file.index.empty()) printf(", frames %u-%u", file.index.front().first, file.index.back().last);
+        puts("");
+        for(size_t c = 0; c < file.columns.size(); c++)
+            printf("%3zu %s\n", c, file.columns[c].name.data());
+        return 0;
+    }
+
+    uint32_t first = strtoul(argv[2], nullptr, 0), last = strtoul(argv[3], nullptr, 0);
+    std::vector<uint32_t> chosen;
+    for(int i = 4; i < argc; i++)
+    {
+        char * end;
+        unsigned long n = strtoul(argv[i], &end, 10);
+        if(*end == 0 and n < file.columns.size())
+        {
+            chosen.push_back(n);
+            continue;
+        }
+        size_t len = strlen(argv[i]);
+        size_t before = chosen.size();
+        for(size_t c = 1; c < file.columns.size(); c++)
+            if(file.columns[c].name.compare(0, len, argv[i]) == 0) chosen.push_back(c);
+        if(chosen.size() == before) return printf("No column \"%s\".\n", argv[i]), 1;
+    }
+    if(argc == 4)
+        for(size_t c = 1; c < file.columns.size(); c++) chosen.push_back(c);
+
+    std::vector<uint32_t> frames;
+    std::vector<std::vector<uint32_t>> values(chosen.size());
+    for(size_t b = file.find(first); b < file.index.size() and file.index[b].first <= last; b++)
+    {
+        if(!file.read(b, 0, frames)) return printf("Block %zu is damaged.\n", b), 1;
+        // blocks are whole; only inflate the columns when some of the block's frames are wanted
+        uint32_t from = 0;
+        while(from < frames.size() and frames[from] < first) from++;
+        if(from == frames.size()) continue;
+        for(size_t i = 0; i < chosen.size(); i++)
+            if(!file.read(b, chosen[i], values[i])) return printf("Block %zu is damaged.\n", b), 1;
+        for(uint32_t r = from; r < frames.size() and frames[r] <= last; r++)
+        {
+            printf("%u", frames[r]);
+            for(size_t i = 0; i < chosen.size(); i++)
+                print_value(file.columns[chosen[i]], values[i][r]);
+            puts("");
+        }
+    }
+    file.close();
+    return 0;
+}
@@ -0,0 +1,335 @@
+#include "reverse.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+#include "coreapi.h"
+
+#define XM(X) extern ptr_##X X;
+COREAPI
+#undef XM
+
+#define NO_HIT UINT64_MAX
+
+void reverser::attach()
+{
+    if(!lock) lock = SDL_CreateMutex();
+}
+
+void reverser::start()
+{
+    stop();
+    SDL_LockMutex(lock);
+    history.assign(REVERSE_HISTORY, 0);
+    next = 0;
+    recorded = 0;
+    written = 0;
+    next_checkpoint = 0;
+    checkpoint_ticks = 0;
+    mode = REVERSE_IDLE;
+    error[0] = 0;
+    enabled = (save.path[0] or statefile_open(save, "reverse-save")) and (load.path[0] or statefile_open(load, "reverse-load"));
+    SDL_UnlockMutex(lock);
+}
+
+void reverser::stop()
+{
+    if(!lock) return;
+    SDL_LockMutex(lock);
+    enabled = false;
+    mode = REVERSE_IDLE;
+    while(!checkpoints.empty()) drop_oldest();
+    std::vector<uint32_t>().swap(history);
+    std::vector<uint8_t>().swap(state);
+    SDL_UnlockMutex(lock);
+}
+
+void reverser::drop(checkpoint * c)
+{
+    for(auto page : c->pages)
+        if(--page->refs == 0)
+        {
+            delete page;
+            pages_used--;
+        }
+    delete c;
+}
+
+void reverser::drop_oldest()
+{
+    drop(checkpoints.front());
+    checkpoints.erase(checkpoints.begin());
+    checkpoint_count = checkpoints.size();
+}
+
+// forgets checkpoints after index, which belong to a future that is being rerun
+void reverser::truncate(uint64_t index)
+{
+    while(!checkpoints.empty() and checkpoints.back()->index > index)
+    {
+        drop(checkpoints.back());
+        checkpoints.pop_back();
+    }
+    checkpoint_count = checkpoints.size();
+    next_checkpoint = checkpoints.empty() ? index : checkpoints.back()->index + spacing;
+    recorded = index;
+}
+
+// keeps the savestate in state as the checkpoint for index
+void reverser::take(uint64_t index)
+{
+    auto start = SDL_GetPerformanceCounter();
+    auto c = new checkpoint;
+    c->index = index;
+    c->size = state.size();
+    c->pages.resize((state.size() + REVERSE_PAGE_BYTES - 1) / REVERSE_PAGE_BYTES);
+    auto last = checkpoints.empty() ? nullptr : checkpoints.back();
+    uint64_t last_index = last ? last->index : 0;
+    bool same = last and last->size == c->size;
+    for(size_t p = 0; p < c->pages.size(); p++)
+    {
+        size_t at = p*REVERSE_PAGE_BYTES, len = std::min<size_t>(REVERSE_PAGE_BYTES, state.size() - at);
+        if(same and memcmp(last->pages[p]->bytes, state.data() + at, len) == 0)
+        {
+            c->pages[p] = last->pages[p];
+            c->pages[p]->refs++;
+            continue;
+        }
+        auto page = new statepage;
+        page->refs = 1;
+        memcpy(page->bytes, state.data() + at, len);
+        c->pages[p] = page;
+        pages_used++;
+    }
+    checkpoints.push_back(c);
+    while(pages_used > budget_pages and checkpoints.size() > 1) drop_oldest();
+    checkpoint_count = checkpoints.size();
+
+    // Spacing from the stepping rate since the previous checkpoint. A long gap means emulation sat
+    // paused in between, which says nothing about the rate.
+    if(last_index < index and checkpoint_ticks)
+    {
+        double seconds = double(start - checkpoint_ticks) / SDL_GetPerformanceFrequency();
+        if(seconds > 0 and seconds < 2)
+        {
+            rate = uint64_t((index - last_index) / seconds);
+            uint64_t s = uint64_t(rate * target_ms / 1000);
+            spacing = s < 1000 ? 1000 : s > (1u << 30) ? (1u << 30) : s;
+        }
+    }
+    checkpoint_ticks = SDL_GetPerformanceCounter();
+    next_checkpoint = index + spacing;
+}
+
+size_t reverser::find(uint64_t index)
+{
+    size_t n = std::partition_point(checkpoints.begin(), checkpoints.end(), [&](const checkpoint * c) { return c->index <= index; })
+        - checkpoints.begin();
+    return n ? n - 1 : checkpoints.size();
+}
+
+bool reverser::rewind(size_t which, int kind)
+{
+    auto c = checkpoints[which];
+    state.resize(c->size);
+    for(size_t p = 0; p < c->pages.size(); p++)
+    {
+        size_t at = p*REVERSE_PAGE_BYTES;
+        memcpy(state.data() + at, c->pages[p]->bytes, std::min<size_t>(REVERSE_PAGE_BYTES, c->size - at));
+    }
+    // a checkpoint of ours still queued is replaced by the load, and never answered
+    if(!saving.exchange(false) and !statejob_claim(STATEJOB_REVERSE))
+        return snprintf(error, sizeof(error), "the rewind buffer has a savestate queued in the core; step and try again"), false;
+    mode = REVERSE_LOAD;
+    loading = which;
+    after_load = kind;
+    if(!statefile_write(load, state.data(), state.size()) or CoreDoCommand(M64CMD_STATE_LOAD, 0, load.path) != M64ERR_SUCCESS)
+    {
+        statejob_release(STATEJOB_REVERSE);
+        mode = REVERSE_IDLE;
+        return snprintf(error, sizeof(error), "could not hand the checkpoint at instruction %llu to the core",
+            (unsigned long long)c->index), false;
+    }
+    return true;
+}
+
+bool reverser::step(uint32_t pc)
+{
+    if(!enabled) return false;
+    SDL_LockMutex(lock);
+    if(!enabled) return SDL_UnlockMutex(lock), false;
+    bool stop = false;
+    uint64_t n = next++;
+    if(mode == REVERSE_HALT)
+    {
+        // what ran on towards the load went unrecorded, so history starts again here
+        while(!checkpoints.empty()) drop_oldest();
+        written = 0;
+        truncate(n);
+        mode = REVERSE_IDLE;
+        stop_pc = pc;
+        stop = true;
+    }
+    else if(mode == REVERSE_LOAD)
+    {
+        // undone by the load at the next interrupt
+    }
+    else if(mode != REVERSE_IDLE and n < recorded and n + REVERSE_HISTORY >= written and history[n & (REVERSE_HISTORY-1)] != pc)
+    {
+        snprintf(error, sizeof(error), "replay went to %08X instead of %08X at instruction %llu",
+            pc, history[n & (REVERSE_HISTORY-1)], (unsigned long long)n);
+        // this run is the history now
+        truncate(n);
+        mode = REVERSE_IDLE;
+        stop_pc = pc;
+        stop = true;
+    }
+    else if(mode == REVERSE_REPLAY)
+    {
+        if(n == target)
+        {
+            mode = REVERSE_IDLE;
+            stop_pc = pc;
+            stop = true;
+        }
+    }
+    else if(mode == REVERSE_SCAN)
+    {
+        bool done = n >= end;
+        if(!done and breakpoint and breakpoint(pc)) last_hit = n;
+        // the span [checkpoints[scanning], end) is scanned
+        bool ok = true;
+        if(done and last_hit != NO_HIT)
+        {
+            target = last_hit;
+            ok = rewind(scanning, REVERSE_REPLAY);
+        }
+        else if(done and scanning == 0)
+        {
+            // like running into the start of a recording: stop at the oldest checkpoint
+            target = checkpoints[0]->index;
+            ok = rewind(0, REVERSE_REPLAY);
+            if(ok) snprintf(error, sizeof(error), "no breakpoint since the oldest checkpoint, instruction %llu", (unsigned long long)target);
+        }
+        else if(done)
+        {
+            end = checkpoints[scanning]->index;
+            scanning--;
+            last_hit = NO_HIT;
+            ok = rewind(scanning, REVERSE_SCAN);
+        }
+        if(!ok)
+        {
+            mode = REVERSE_IDLE;
+            stop_pc = pc;
+            stop = true;
+        }
+    }
+    if(mode == REVERSE_IDLE and !stop)
+    {
+        if(n < recorded) truncate(n);
+        history[n & (REVERSE_HISTORY-1)] = pc;
+        recorded = n + 1;
+        if(written < recorded) written = recorded;
+    }
+    else if(stop)
+    {
+        // the stop is before the instruction at pc, which the core runs without reporting it again
+        history[n & (REVERSE_HISTORY-1)] = pc;
+        if(recorded < n + 1) recorded = n + 1;
+        if(written < recorded) written = recorded;
+    }
+    SDL_UnlockMutex(lock);
+    return stop;
+}
+
+void reverser::frame()
+{
+    if(!enabled or mode != REVERSE_IDLE or saving or next < next_checkpoint) return;
+    // the rewind buffer's savestate is still with the core; tried again next frame
+    if(!statejob_claim(STATEJOB_REVERSE)) return;
+    saving = true;
+    if(CoreDoCommand(M64CMD_STATE_SAVE, STATE_PJ64_UNCOMPRESSED, save.path) != M64ERR_SUCCESS)
+    {
+        saving = false;
+        statejob_release(STATEJOB_REVERSE);
+    }
+}
+
+void reverser::saved(bool ok)
+{
+    if(!statejob_held(STATEJOB_REVERSE)) return;
+    statejob_release(STATEJOB_REVERSE);
+    if(!saving.exchange(false) or !ok) return;
+    SDL_LockMutex(lock);
+    // the core runs instruction next once the callback returns
+    if(enabled and mode == REVERSE_IDLE and statefile_read(save, state)) take(next);
+    SDL_UnlockMutex(lock);
+}
+
+void reverser::loaded(bool ok)
+{
+    if(!statejob_held(STATEJOB_REVERSE)) return;
+    statejob_release(STATEJOB_REVERSE);
+    SDL_LockMutex(lock);
+    if(enabled and mode == REVERSE_LOAD)
+    {
+        if(ok)
+        {
+            next = checkpoints[loading]->index;
+            mode = after_load;
+        }
+        else
+        {
+            snprintf(error, sizeof(error), "the core could not load the checkpoint at instruction %llu; history starts again here",
+                (unsigned long long)checkpoints[loading]->index);
+            mode = REVERSE_HALT;
+        }
+    }
+    SDL_UnlockMutex(lock);
+}
+
+void reverser::halted()
+{
+    statejob_release(STATEJOB_REVERSE);
+    saving = false;
+    mode = REVERSE_IDLE;
+}
+
+bool reverser::request(int kind)
+{
+    error[0] = 0;
+    if(!enabled or next < 2) return snprintf(error, sizeof(error), "no history before this instruction"), false;
+    SDL_LockMutex(lock);
+    // parked before instruction here, which has been numbered already
+    uint64_t here = next - 1;
+    size_t k = find(here - 1);
+    bool run = false;
+    if(mode != REVERSE_IDLE) snprintf(error, sizeof(error), "still going back");
+    else if(k == checkpoints.size()) snprintf(error, sizeof(error), "no checkpoint before instruction %llu", (unsigned long long)here);
+    else if(kind == REVERSE_REPLAY)
+    {
+        target = here - 1;
+        run = rewind(k, kind);
+    }
+    else
+    {
+        scanning = k;
+        end = here;
+        last_hit = NO_HIT;
+        run = rewind(k, kind);
+    }
+    SDL_UnlockMutex(lock);
+    return run;
+}
+
+bool reverser::step_back()
+{
+    return request(REVERSE_REPLAY);
+}
+
+bool reverser::reverse_continue()
+{
+    return request(REVERSE_SCAN);
+}
@@ -0,0 +1,112 @@
+#include <stdint.h>
+#include <vector>
+#include <atomic>
+
+#include <SDL2/SDL.h>
+
+#include "statefile.hpp"
+
+// checkpoints keep savestates in pages of this many bytes, and share the ones that didn't change
+#define REVERSE_PAGE_BYTES 4096
+// PCs remembered for checking that a replay retraces the original run; a power of two
+#define REVERSE_HISTORY (1 << 20)
+
+struct statepage {
+    uint32_t refs;
+    uint8_t bytes[REVERSE_PAGE_BYTES];
+};
+
+struct checkpoint {
+    uint64_t index; // instruction the core runs first after loading it
+    uint32_t size; // of the savestate
+    std::vector<statepage *> pages;
+};
+
+enum {
+    REVERSE_IDLE, // recording: checkpoints and PC history
+    REVERSE_LOAD, // running on to the core's next interrupt, where it loads a checkpoint
+    REVERSE_REPLAY, // running forward to target
+    REVERSE_SCAN, // running forward to end, remembering the last breakpoint hit
+    REVERSE_HALT // a load failed; stopping at the next instruction
+};
+
+// Reverse execution by checkpoint and replay. While the core steps, step() numbers each instruction
+// and keeps a ring of recent PCs. Every spacing instructions, at a frame, frame() has the core save an
+// uncompressed savestate into a memfd; saved() reads it when the core reports it written, at its next
+// interrupt, and numbers it with the instruction the core runs next. A checkpoint copies only the
+// pages of the state that differ from the previous checkpoint's and shares the rest by reference
+// count, so a run that touches little memory costs little more than its first state; the oldest
+// checkpoints go when the pages outgrow the budget. spacing follows the measured stepping rate so that
+// replaying from the nearest checkpoint takes about target_ms.
+// Going back hands the newest checkpoint before the target to the core and lets it run on to its next
+// interrupt, where it loads it; loaded() then renumbers, and the replay runs forward to the target.
+// Reverse-continue scans the spans between checkpoints, newest first, for the last instruction where
+// an execute breakpoint holds, then replays to it. A savestate holds the core's interrupt queue and
+// count bookkeeping along with the CPU, TLB and memory, so a replay retraces the original run and the
+// core goes on from the target as it did the first time; replays are still checked against the PC
+// history, and stop with an error where one goes elsewhere.
+// Numbering needs the core to report every instruction, which only the pure interpreter does.
+// step(), frame(), saved() and loaded() run on the emulation thread; step_back() and
+// reverse_continue() on the UI thread while the core is parked in the debugger.
+struct reverser {
+    double target_ms = 100;
+    uint32_t budget_pages = 65536; // 256 MiB
+    bool (*breakpoint)(uint32_t pc) = nullptr; // an execute breakpoint at pc holds
+
+    std::atomic<bool> enabled{false};
+    SDL_mutex * lock = nullptr; // keeps step() out while history starts, stops or rewinds
+    std::atomic<int> mode{REVERSE_IDLE};
+    std::vector<checkpoint *> checkpoints; // oldest first
+    std::atomic<uint32_t> checkpoint_count{0};
+    std::atomic<uint32_t> pages_used{0};
+    std::atomic<uint64_t> spacing{100000};
+    std::atomic<uint64_t> rate{0}; // instructions per second at the last checkpoint
+    std::atomic<uint64_t> next{0}; // number of the instruction the next step() sees
+    uint64_t recorded = 0; // history is valid below this
+    uint64_t written = 0; // and above this minus REVERSE_HISTORY, which rerunning doesn't lower
+    uint64_t next_checkpoint = 0;
+    uint64_t checkpoint_ticks = 0;
+    std::vector<uint32_t> history;
+
+    // the core's savestates; opened once and kept, since a job still queued in the core names them
+    statefile save;
+    statefile load;
+    std::vector<uint8_t> state;
+    std::atomic<bool> saving{false}; // a checkpoint was asked for and the core hasn't written it
+    size_t loading = 0; // load: the checkpoint being loaded
+    int after_load = REVERSE_IDLE; // load: replay or scan once it is in
+
+    uint64_t target = 0; // replay: stop before this instruction
+    uint64_t end = 0; // scan: stop before this one
+    uint64_t last_hit = 0; // scan: UINT64_MAX while nothing was found
+    size_t scanning = 0; // scan: checkpoint the current span starts at
+    uint32_t stop_pc = 0; // where step() last stopped emulation
+    char error[128] = "";
+
+    // debugger init callback
+    void attach();
+    void start();
+    void stop();
+    // emulation thread, before the instruction at pc runs; true if emulation stops, at stop_pc
+    bool step(uint32_t pc);
+    // frame callback: asks for a checkpoint when one is due
+    void frame();
+    // core state callbacks: a savestate was written or loaded, or emulation stopped
+    void saved(bool ok);
+    void loaded(bool ok);
+    void halted();
+    // parked core: rewinds by one instruction, or to the last breakpoint hit before now. True if the
+    // core must step on to get there; false, with error set, if it can't go.
+    bool step_back();
+    bool reverse_continue();
+
+    bool request(int kind);
+    // hands checkpoint which to the core, to replay or scan from once loaded; lock held
+    bool rewind(size_t which, int kind);
+    void take(uint64_t index);
+    // newest checkpoint at or before index
+    size_t find(uint64_t index);
+    void drop(checkpoint * c);
+    void drop_oldest();
+    void truncate(uint64_t index);
+};
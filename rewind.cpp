@@ -0,0 +1,431 @@
+#include "rewind.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <vector>
+#include <deque>
+
+#include <zlib.h>
+#include <SDL2/SDL.h>
+
+#include "coreapi.h"
+#include "statefile.hpp"
+
+#define XM(X) extern ptr_##X X;
+COREAPI
+#undef XM
+
+// bytes of a delta inflated at once when rewinding
+#define DELTA_CHUNK 65536
+// frames to wait for the core to answer a save or load; it does them at its next interrupt, so one
+// that takes this long was dropped
+#define STATE_TIMEOUT 120
+
+rewinder_stats rewindstats;
+
+struct rewindentry {
+    uint64_t frame; // of the state this delta gives back from the one after it
+    size_t offset; // in the ring
+    uint32_t size;
+};
+
+static struct {
+    rewinder_config config;
+    statefile save;
+    statefile load;
+    // files from a stop while the core still had a job on one; its answer closes them
+    statefile orphan_save;
+    statefile orphan_load;
+    SDL_Thread * thread = nullptr;
+    SDL_sem * wake = nullptr;
+    SDL_mutex * orphan_lock = nullptr; // the stop and the core's answer may both close them
+    std::atomic<bool> active{false};
+    std::atomic<bool> running{false};
+
+    std::atomic<uint64_t> clock{0}; // emulated frames; set back by a rewind
+    uint32_t since = 0; // frames since the last capture
+    std::atomic<bool> capturing{false}; // a save was asked for and the worker hasn't read it yet
+    std::atomic<bool> captured{false}; // the core has written it
+    std::atomic<uint64_t> capture_clock{0};
+    std::atomic<bool> loading{false}; // a rewind is under way; no captures until the core has loaded it
+    std::atomic<bool> load_issued{false};
+    std::atomic<uint64_t> load_issued_clock{0};
+    std::atomic<uint64_t> back{0}; // frames to go back by
+    uint64_t load_clock = 0;
+
+    std::vector<uint8_t> ring;
+    std::deque<rewindentry> entries; // oldest first
+    size_t tail = 0; // where the newest entry ends
+    uint64_t used = 0;
+    std::vector<uint8_t> latest; // newest state, whole; empty until the first capture
+    uint64_t latest_clock = 0;
+    std::vector<uint8_t> state; // read from the core, or being rebuilt
+    std::vector<uint8_t> delta;
+    std::vector<uint8_t> packed;
+} rewinder;
+
+static void report(const char * format, ...)
+{
+    if(!rewinder.config.report) return;
+    char text[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    rewinder.config.report(text);
+}
+
+// a ^= b, a word at a time
+static void xor_into(uint8_t * a, const uint8_t * b, size_t len)
+{
+    size_t words = len / 8;
+    auto x = (uint64_t *) a;
+    auto y = (const uint64_t *) b;
+    for(size_t i = 0; i < words; i++) x[i] ^= y[i];
+    for(size_t i = words*8; i < len; i++) a[i] ^= b[i];
+}
+
+// state ^= a packed delta, inflated a chunk at a time so that it is XORed while still in cache
+static bool apply(const rewindentry & e, std::vector<uint8_t> & state)
+{
+    auto & r = rewinder;
+    z_stream z = {};
+    if(inflateInit(&z) != Z_OK) return false;
+    z.next_in = r.ring.data() + e.offset;
+    z.avail_in = e.size;
+    size_t at = 0;
+    int ret = Z_OK;
+    while(ret == Z_OK)
+    {
+        z.next_out = r.delta.data();
+        z.avail_out = r.delta.size();
+        ret = inflate(&z, Z_NO_FLUSH);
+        size_t got = z.next_out - r.delta.data();
+        if(at + got > state.size()) break;
+        xor_into(state.data() + at, r.delta.data(), got);
+        at += got;
+    }
+    inflateEnd(&z);
+    return ret == Z_STREAM_END and at == state.size();
+}
+
+static void close_orphans()
+{
+    auto & r = rewinder;
+    SDL_LockMutex(r.orphan_lock);
+    statefile_close(r.orphan_save);
+    statefile_close(r.orphan_load);
+    SDL_UnlockMutex(r.orphan_lock);
+}
+
+static void update_stats()
+{
+    auto & r = rewinder;
+    rewindstats.states = r.entries.size() + !r.latest.empty();
+    rewindstats.bytes = r.used;
+    rewindstats.state_bytes = r.latest.size();
+    rewindstats.oldest = r.entries.empty() ? r.latest_clock : r.entries.front().frame;
+    rewindstats.newest = r.latest_clock;
+}
+
+static void drop_oldest()
+{
+    auto & r = rewinder;
+    r.used -= r.entries.front().size;
+    r.entries.pop_front();
+    if(r.entries.empty()) r.tail = 0;
+}
+
+static void drop_newest()
+{
+    auto & r = rewinder;
+    r.used -= r.entries.back().size;
+    r.entries.pop_back();
+    r.tail = r.entries.empty() ? 0 : r.entries.back().offset + r.entries.back().size;
+}
+
+static void push(uint64_t frame, const uint8_t * data, uint32_t size)
+{
+    auto & r = rewinder;
+    // a delta that can't fit leaves nothing older reachable
+    if(size > r.ring.size())
+    {
+        while(!r.entries.empty()) drop_oldest();
+        return;
+    }
+    bool wrap = r.tail + size > r.ring.size();
+    size_t at = wrap ? 0 : r.tail;
+    // the oldest entries are the ones from tail on; they go until the new one fits, and all of those
+    // up to the end of the ring go when it wraps
+    while(!r.entries.empty())
+    {
+        size_t o = r.entries.front().offset;
+        if(wrap ? o >= r.tail or o < size : o >= r.tail and o < r.tail + size) drop_oldest();
+        else break;
+    }
+    memcpy(r.ring.data() + at, data, size);
+    r.entries.push_back({frame, at, size});
+    r.tail = at + size;
+    r.used += size;
+}
+
+// takes in the state the core just wrote
+static void absorb()
+{
+    auto & r = rewinder;
+    bool ok = statefile_read(r.save, r.state);
+    uint64_t frame = r.capture_clock;
+    r.captured = false;
+    r.capturing = false;
+    if(!ok) return;
+    rewindstats.captures++;
+    if(r.latest.size() != r.state.size())
+    {
+        while(!r.entries.empty()) drop_oldest();
+    }
+    else
+    {
+        xor_into(r.latest.data(), r.state.data(), r.latest.size());
+        uLongf size = compressBound(r.latest.size());
+        r.packed.resize(size);
+        if(compress2(r.packed.data(), &size, r.latest.data(), r.latest.size(), r.config.level) == Z_OK)
+            push(r.latest_clock, r.packed.data(), size);
+        else while(!r.entries.empty()) drop_oldest();
+    }
+    r.latest.swap(r.state);
+    r.latest_clock = frame;
+    update_stats();
+}
+
+// rebuilds the newest state at or before the target and hands it to the core
+static void restore()
+{
+    auto & r = rewinder;
+    uint64_t now = r.clock, back = r.back;
+    uint64_t want = now > back ? now - back : 0;
+    if(r.latest.empty())
+    {
+        r.loading = false;
+        return report("Rewind: nothing recorded yet.");
+    }
+    // a reverse checkpoint still with the core; rewinder_frame wakes the worker to try again
+    if(!statejob_claim(STATEJOB_REWIND)) return;
+    r.state = r.latest;
+    uint64_t frame = r.latest_clock;
+    while(frame > want and !r.entries.empty())
+    {
+        auto & e = r.entries.back();
+        if(!apply(e, r.state))
+        {
+            while(!r.entries.empty()) drop_oldest();
+            break;
+        }
+        frame = e.frame;
+        drop_newest();
+    }
+    r.latest.swap(r.state);
+    r.latest_clock = frame;
+    update_stats();
+    r.load_clock = frame;
+    // the core may load it and call back before CoreDoCommand returns
+    r.load_issued_clock = r.clock.load();
+    r.load_issued = true;
+    if(!statefile_write(r.load, r.latest.data(), r.latest.size()) or CoreDoCommand(M64CMD_STATE_LOAD, 0, r.load.path) != M64ERR_SUCCESS)
+    {
+        statejob_release(STATEJOB_REWIND);
+        r.load_issued = false;
+        r.loading = false;
+        return report("Rewind: could not hand the state to the core.");
+    }
+    double seconds = (now - frame) / r.config.fps;
+    if(frame > want) report("Rewind: only %.1f s recorded; going back to the oldest state.", seconds);
+    else report("Rewind: going back %.1f s, to frame %llu.", seconds, (unsigned long long)frame);
+}
+
+static int rewinder_thread(void *)
+{
+    auto & r = rewinder;
+    while(1)
+    {
+        SDL_SemWait(r.wake);
+        if(!r.running) break;
+        if(r.captured) absorb();
+        // a save still on its way would land after the load
+        if(r.loading and !r.load_issued and !r.capturing) restore();
+    }
+    return 0;
+}
+
+int rewinder_start(const rewinder_config & config)
+{
+    auto & r = rewinder;
+    if(r.active) return -1;
+    r.config = config;
+    if(!r.wake) r.wake = SDL_CreateSemaphore(0);
+    if(!r.orphan_lock) r.orphan_lock = SDL_CreateMutex();
+    if(!r.wake or !r.orphan_lock) return -1;
+    r.ring.assign(size_t(config.budget_mb) << 20, 0);
+    r.delta.resize(DELTA_CHUNK);
+    r.entries.clear();
+    r.tail = 0;
+    r.used = 0;
+    r.latest.clear();
+    r.latest_clock = 0;
+    r.since = 0;
+    r.capturing = false;
+    r.captured = false;
+    r.loading = false;
+    r.load_issued = false;
+    rewindstats.lost = 0;
+    if(!statefile_open(r.save, "rewind-save") or !statefile_open(r.load, "rewind-load"))
+    {
+        statefile_close(r.save);
+        statefile_close(r.load);
+        return -1;
+    }
+    update_stats();
+    rewindstats.captures = 0;
+    rewindstats.late = 0;
+    r.running = true;
+    r.thread = SDL_CreateThread(rewinder_thread, "Rewind Thread", NULL);
+    if(!r.thread)
+    {
+        r.running = false;
+        statefile_close(r.save);
+        statefile_close(r.load);
+        return -1;
+    }
+    r.active = true;
+    return 0;
+}
+
+void rewinder_stop()
+{
+    auto & r = rewinder;
+    if(!r.active) return;
+    r.active = false;
+    r.running = false;
+    SDL_SemPost(r.wake);
+    SDL_WaitThread(r.thread, NULL);
+    r.thread = nullptr;
+    // A save or load still queued in the core would go to whatever file gets the fd next, and the core
+    // only gets to it at an interrupt, which a parked core never reaches. The files stay open until it
+    // answers; the claim on the job is kept until then, so nothing else can be mistaken for the answer.
+    SDL_LockMutex(r.orphan_lock);
+    // with orphans already there, the job is theirs and these files were never handed over
+    if(statejob_held(STATEJOB_REWIND) and r.save.fd >= 0 and r.orphan_save.fd < 0)
+    {
+        r.orphan_save = r.save;
+        r.orphan_load = r.load;
+        r.save = statefile();
+        r.load = statefile();
+    }
+    SDL_UnlockMutex(r.orphan_lock);
+    statefile_close(r.save);
+    statefile_close(r.load);
+    r.capturing = false;
+    r.captured = false;
+    r.loading = false;
+    r.load_issued = false;
+    std::vector<uint8_t>().swap(r.ring);
+    std::vector<uint8_t>().swap(r.latest);
+    std::vector<uint8_t>().swap(r.state);
+    std::vector<uint8_t>().swap(r.delta);
+    std::vector<uint8_t>().swap(r.packed);
+    r.entries.clear();
+}
+
+bool rewinder_active()
+{
+    return rewinder.active;
+}
+
+void rewinder_frame()
+{
+    auto & r = rewinder;
+    uint64_t frame = ++r.clock;
+    if(!r.active) return;
+    if(r.capturing and !r.captured and frame > r.capture_clock + STATE_TIMEOUT)
+    {
+        rewindstats.lost++;
+        statejob_release(STATEJOB_REWIND);
+        r.capturing = false;
+        // a rewind waiting for it goes ahead
+        SDL_SemPost(r.wake);
+    }
+    if(r.load_issued and frame > r.load_issued_clock + STATE_TIMEOUT)
+    {
+        rewindstats.lost++;
+        statejob_release(STATEJOB_REWIND);
+        r.load_issued = false;
+        r.loading = false;
+        report("Rewind: the core never loaded the state.");
+    }
+    // a rewind put off while reverse stepping had the core's savestate job
+    if(r.loading and !r.load_issued and !r.capturing) SDL_SemPost(r.wake);
+    if(++r.since < r.config.every) return;
+    if(r.capturing or r.loading)
+    {
+        if(r.since == r.config.every and r.capturing) rewindstats.late++;
+        return;
+    }
+    // a reverse checkpoint still with the core; tried again next frame
+    if(!statejob_claim(STATEJOB_REWIND)) return;
+    r.since = 0;
+    r.capture_clock = frame;
+    r.capturing = true;
+    if(CoreDoCommand(M64CMD_STATE_SAVE, STATE_PJ64_UNCOMPRESSED, r.save.path) != M64ERR_SUCCESS)
+    {
+        statejob_release(STATEJOB_REWIND);
+        r.capturing = false;
+    }
+}
+
+void rewinder_saved(bool ok)
+{
+    auto & r = rewinder;
+    if(!statejob_held(STATEJOB_REWIND)) return;
+    statejob_release(STATEJOB_REWIND);
+    close_orphans();
+    if(!r.active or !r.capturing or r.captured) return;
+    // a rewind waiting for this save goes ahead either way
+    if(ok) r.captured = true;
+    else r.capturing = false;
+    SDL_SemPost(r.wake);
+}
+
+void rewinder_loaded(bool ok)
+{
+    auto & r = rewinder;
+    if(!statejob_held(STATEJOB_REWIND)) return;
+    statejob_release(STATEJOB_REWIND);
+    close_orphans();
+    if(!r.active or !r.load_issued) return;
+    if(ok) r.clock = r.load_clock;
+    else report("Rewind: the core could not load the state.");
+    if(ok and r.config.loaded) r.config.loaded();
+    r.since = 0;
+    r.load_issued = false;
+    r.loading = false;
+}
+
+void rewinder_halted()
+{
+    auto & r = rewinder;
+    statejob_release(STATEJOB_REWIND);
+    close_orphans();
+    r.capturing = false;
+    r.load_issued = false;
+    r.loading = false;
+}
+
+bool rewinder_back(double seconds)
+{
+    auto & r = rewinder;
+    if(!r.active or r.loading) return false;
+    r.back = seconds > 0 ? uint64_t(seconds * r.config.fps + 0.5) : 0;
+    r.loading = true;
+    SDL_SemPost(r.wake);
+    return true;
+}
@@ -0,0 +1,47 @@
+#include <stdint.h>
+#include <atomic>
+
+struct rewinder_config {
+    uint32_t every = 30; // frames between captures
+    uint32_t budget_mb = 64; // ring of packed deltas
+    int level = 1; // deflate level
+    double fps = 60; // emulated frames per second, for going back by seconds; 50 on PAL
+    void (*report)(const char * text) = nullptr; // outcome of a rewind, from the worker thread
+    void (*loaded)() = nullptr; // the core has loaded a rewound state; emulation thread
+};
+
+struct rewinder_stats {
+    std::atomic<uint32_t> states{0};
+    std::atomic<uint64_t> bytes{0}; // of the ring in use
+    std::atomic<uint64_t> state_bytes{0}; // of one state, unpacked
+    std::atomic<uint64_t> oldest{0}; // frame of the oldest state
+    std::atomic<uint64_t> newest{0};
+    std::atomic<uint64_t> captures{0};
+    std::atomic<uint32_t> late{0}; // captures put off because the worker hadn't taken the last one
+    std::atomic<uint32_t> lost{0}; // saves and loads the core never answered
+};
+
+// Rewind buffer of savestates. Every config.every frames the frame callback asks the core for an
+// uncompressed savestate into an in-memory file (memfd on Linux); the core writes it at its next
+// interrupt and reports back through the state callback. A worker thread reads it, XORs it with the
+// state before and deflates the difference, which for consecutive states is mostly zeros, into a
+// ring of fixed size. Deltas run backwards from the newest state, which the worker keeps whole, so
+// the oldest delta can go without touching the others. Going back applies deltas newest first, then
+// has the core load the result; the states after it are dropped. The emulation thread only ever
+// asks for the save, and skips a capture while the worker is still on the last one, or while reverse
+// stepping has the core's savestate job. A save or load the core hasn't answered within a couple of
+// seconds of emulated time is given up on. Stopping with one still queued leaves its files open until
+// the core answers, since it would otherwise write into whatever file got the fd next.
+int rewinder_start(const rewinder_config & config);
+void rewinder_stop();
+bool rewinder_active();
+// emulation thread, once per frame
+void rewinder_frame();
+// core state callback: a savestate was written or loaded
+void rewinder_saved(bool ok);
+void rewinder_loaded(bool ok);
+// core state callback: emulation stopped, and with it any save or load still queued
+void rewinder_halted();
+// goes back about seconds of emulated time; false while the last rewind hasn't been loaded yet
+bool rewinder_back(double seconds);
+extern rewinder_stats rewindstats;
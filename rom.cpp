@@ -0,0 +1,526 @@
+#include "rom.hpp"
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <atomic>
+#include <vector>
+
+#include <SDL2/SDL.h>
+#include <zlib.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define ROM_X86
+#endif
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif //  _WIN32
+
+#ifndef _WIN32
+
+int rom_map(romimage & image, const char * fname)
+{
+    int fd = open(fname, O_RDONLY);
+    if(fd < 0) return puts("ROM file does not exist. Doublecheck the filename."), -1;
+    
+    struct stat info;
+    if(fstat(fd, &info) != 0 or info.st_size <= 0 or uint64_t(info.st_size) > UINT32_MAX)
+        return puts("ROM file is empty or too large."), close(fd), -1;
+    
+    auto size = uint32_t(info.st_size);
+    auto data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping keeps its own reference to the file
+    if(data == MAP_FAILED) return puts("Failed to map ROM file into memory."), -1;
+    
+    image.data = (char *)data;
+    image.size = size;
+    image.mapped = true;
+    return 0;
+}
+
+void rom_prefetch(romimage & image)
+{
+    if(!image.mapped) return;
+    // the core copies the image front to back exactly once
+    madvise(image.data, image.size, MADV_SEQUENTIAL);
+    madvise(image.data, image.size, MADV_WILLNEED);
+}
+
+#else  //  _WIN32
+
+int rom_map(romimage & image, const char * fname)
+{
+    FILE * rom = fopen(fname, "rb");
+    if(!rom) return puts("ROM file does not exist. Doublecheck the filename."), -1;
+    
+    fseek(rom, 0, SEEK_END);
+    auto size = ftell(rom);
+    fseek(rom, 0, SEEK_SET);
+    if(size <= 0) return puts("ROM file is empty."), fclose(rom), -1;
+    
+    auto data = (char*)malloc(size);
+    if(!data) return puts("Allocation error when loading ROM."), fclose(rom), -1;
+    if(fread(data, 1, size, rom) != size_t(size)) return puts("Failed to load ROM data into RAM."), free(data), fclose(rom), -1;
+    fclose(rom);
+    
+    image.data = data;
+    image.size = size;
+    image.mapped = false;
+    return 0;
+}
+
+void rom_prefetch(romimage & image) { }
+
+#endif //  _WIN32
+
+void rom_unmap(romimage & image)
+{
+    if(!image.data) return;
+    #ifndef _WIN32
+    if(image.mapped)
+        munmap(image.data, image.size);
+    else
+    #endif //  _WIN32
+        free(image.data);
+    image.data = nullptr;
+    image.size = 0;
+    image.mapped = false;
+}
+
+int rom_byteorder(const romimage & image)
+{
+    if(image.size < 4) return ROM_UNKNOWN;
+    auto h = (const unsigned char *)image.data;
+    if(h[0] == 0x80 and h[1] == 0x37 and h[2] == 0x12 and h[3] == 0x40) return ROM_Z64;
+    if(h[0] == 0x37 and h[1] == 0x80 and h[2] == 0x40 and h[3] == 0x12) return ROM_V64;
+    if(h[0] == 0x40 and h[1] == 0x12 and h[2] == 0x37 and h[3] == 0x80) return ROM_N64;
+    return ROM_UNKNOWN;
+}
+
+static void swap16_scalar(char * data, uint32_t len)
+{
+    for(uint32_t i = 0; i+2 <= len; i += 2)
+    {
+        char t = data[i];
+        data[i] = data[i+1];
+        data[i+1] = t;
+    }
+}
+static void swap32_scalar(char * data, uint32_t len)
+{
+    for(uint32_t i = 0; i+4 <= len; i += 4)
+    {
+        uint32_t w;
+        memcpy(&w, data+i, 4);
+        w = __builtin_bswap32(w);
+        memcpy(data+i, &w, 4);
+    }
+}
+
+#ifdef ROM_X86
+
+__attribute__((target("avx2")))
+static uint32_t swap_avx2(char * data, uint32_t len, bool words)
+{
+    auto mask = words
+        ? _mm256_setr_epi8(3,2,1,0, 7,6,5,4, 11,10,9,8, 15,14,13,12, 3,2,1,0, 7,6,5,4, 11,10,9,8, 15,14,13,12)
+        : _mm256_setr_epi8(1,0, 3,2, 5,4, 7,6, 9,8, 11,10, 13,12, 15,14, 1,0, 3,2, 5,4, 7,6, 9,8, 11,10, 13,12, 15,14);
+    uint32_t i = 0;
+    for(; i+32 <= len; i += 32)
+    {
+        auto v = _mm256_loadu_si256((__m256i *)(data+i));
+        _mm256_storeu_si256((__m256i *)(data+i), _mm256_shuffle_epi8(v, mask));
+    }
+    return i;
+}
+
+// SSE2 has no byte shuffle; swap bytes within halfwords with shifts, then swap halfwords for 32-bit order
+static uint32_t swap_sse2(char * data, uint32_t len, bool words)
+{
+    uint32_t i = 0;
+    for(; i+16 <= len; i += 16)
+    {
+        auto v = _mm_loadu_si128((__m128i *)(data+i));
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        if(words)
+        {
+            v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2,3,0,1));
+            v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2,3,0,1));
+        }
+        _mm_storeu_si128((__m128i *)(data+i), v);
+    }
+    return i;
+}
+
+static uint32_t swap_vector(char * data, uint32_t len, bool words)
+{
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    return avx2 ? swap_avx2(data, len, words) : swap_sse2(data, len, words);
+}
+
+#else  //  ROM_X86
+
+static uint32_t swap_vector(char * data, uint32_t len, bool words) { return 0; }
+
+#endif //  ROM_X86
+
+void rom_swap16(char * data, uint32_t len)
+{
+    auto done = swap_vector(data, len, false);
+    swap16_scalar(data+done, len-done);
+}
+void rom_swap32(char * data, uint32_t len)
+{
+    auto done = swap_vector(data, len, true);
+    swap32_scalar(data+done, len-done);
+}
+
+int rom_normalize(romimage & image, int order)
+{
+    if(order != ROM_V64 and order != ROM_N64) return 0;
+    #ifndef _WIN32
+    if(image.mapped and mprotect(image.data, image.size, PROT_READ|PROT_WRITE) != 0)
+        return puts("Could not make ROM mapping writable for byteswapping."), -1;
+    #endif //  _WIN32
+    if(order == ROM_V64) rom_swap16(image.data, image.size);
+    if(order == ROM_N64) rom_swap32(image.data, image.size);
+    return 0;
+}
+
+// word-at-a-time multiply/xorshift hash; not cryptographic, only used to key caches
+uint64_t rom_hash64(const char * data, uint32_t len)
+{
+    const uint64_t k = 0x9E3779B97F4A7C15ULL;
+    uint64_t h = len * k;
+    uint32_t i = 0;
+    for(; i+8 <= len; i += 8)
+    {
+        uint64_t w;
+        memcpy(&w, data+i, 8);
+        h = (h ^ (w * k)) * 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 32;
+    }
+    uint64_t w = 0;
+    memcpy(&w, data+i, len-i);
+    h = (h ^ (w * k)) * 0xC4CEB9FE1A85EC53ULL;
+    return h ^ (h >> 29);
+}
+
+static void cache_path(char * out, size_t len, const char * dir, uint64_t hash)
+{
+    snprintf(out, len, "%s/%016llX.z64", dir, (unsigned long long)hash);
+}
+
+int rom_cache_lookup(romimage & image, const char * dir, uint64_t hash)
+{
+    char path[4096];
+    cache_path(path, sizeof(path), dir, hash);
+    if(FILE * f = fopen(path, "rb"))
+        fclose(f);
+    else
+        return -1;
+    
+    romimage cached;
+    if(rom_map(cached, path)) return -1;
+    if(cached.size != image.size or rom_byteorder(cached) != ROM_Z64)
+        return rom_unmap(cached), -1;
+    
+    rom_unmap(image);
+    image = cached;
+    return 0;
+}
+
+int rom_cache_store(const romimage & image, const char * dir, uint64_t hash)
+{
+    char path[4096], temp[4096+8];
+    cache_path(path, sizeof(path), dir, hash);
+    snprintf(temp, sizeof(temp), "%s.part", path);
+    
+    #ifndef _WIN32
+    mkdir(dir, 0755);
+    #endif //  _WIN32
+    FILE * f = fopen(temp, "wb");
+    if(!f) return -1;
+    bool ok = fwrite(image.data, 1, image.size, f) == image.size;
+    ok = (fclose(f) == 0) and ok;
+    // write then rename so a crashed store never leaves a truncated image under the real name
+    if(!ok or rename(temp, path) != 0)
+        return remove(temp), -1;
+    return 0;
+}
+
+int rom_container(const romimage & image)
+{
+    auto h = (const unsigned char *)image.data;
+    if(image.size >= 18 and h[0] == 0x1F and h[1] == 0x8B and h[2] == 8) return ROM_GZIP;
+    if(image.size >= 22 and h[0] == 'P' and h[1] == 'K' and h[2] == 3 and h[3] == 4) return ROM_ZIP;
+    return ROM_RAW;
+}
+
+static uint16_t le16(const unsigned char * p) { return p[0] | p[1]<<8; }
+static uint32_t le32(const unsigned char * p) { return p[0] | p[1]<<8 | p[2]<<16 | uint32_t(p[3])<<24; }
+
+static double ms_between(Uint64 a, Uint64 b)
+{
+    return (b-a)*1000.0/SDL_GetPerformanceFrequency();
+}
+
+// one gzip member: where it starts in the file, its total size, and where its output goes
+struct gzmember {
+    uint32_t offset;
+    uint32_t size;
+    uint32_t out;
+    uint32_t outsize;
+};
+
+// collects member boundaries from BSIZE ('BC') extra fields; fails if any member lacks one
+static bool gzip_blocks(const romimage & image, std::vector<gzmember> & members, uint32_t & total)
+{
+    auto h = (const unsigned char *)image.data;
+    uint64_t out = 0;
+    uint32_t i = 0;
+    while(i < image.size)
+    {
+        if(image.size - i < 18 or h[i] != 0x1F or h[i+1] != 0x8B or h[i+2] != 8 or !(h[i+3] & 4)) return false;
+        uint32_t xlen = le16(h+i+10);
+        if(image.size - i < 12 + xlen) return false;
+        uint32_t bsize = 0;
+        for(uint32_t x = 0; x+4 <= xlen; x += 4 + le16(h+i+12+x+2))
+        {
+            auto f = h+i+12+x;
+            if(f[0] == 'B' and f[1] == 'C' and le16(f+2) == 2)
+                bsize = le16(f+4) + 1;
+        }
+        if(bsize < 12 + xlen + 8 or bsize > image.size - i) return false;
+        uint32_t isize = le32(h+i+bsize-4);
+        members.push_back({i, bsize, uint32_t(out), isize});
+        out += isize;
+        if(out > UINT32_MAX) return false;
+        i += bsize;
+    }
+    total = out;
+    return !members.empty();
+}
+
+struct gzjob {
+    const romimage * image;
+    char * dst;
+    std::vector<gzmember> * members;
+    std::atomic<uint32_t> next;
+    std::atomic<bool> failed;
+    std::atomic<Uint64> first_byte;
+};
+
+static int gzip_worker(void * ptr)
+{
+    auto job = (gzjob *)ptr;
+    z_stream z = {};
+    if(inflateInit2(&z, 16+MAX_WBITS) != Z_OK) return job->failed = true, -1;
+    for(uint32_t n; (n = job->next++) < job->members->size() and !job->failed; )
+    {
+        auto & m = (*job->members)[n];
+        inflateReset(&z);
+        z.next_in = (Bytef *)job->image->data + m.offset;
+        z.avail_in = m.size;
+        z.next_out = (Bytef *)job->dst + m.out;
+        z.avail_out = m.outsize;
+        auto r = inflate(&z, Z_FINISH);
+        if(m.outsize and z.avail_out != m.outsize)
+        {
+            Uint64 none = 0;
+            job->first_byte.compare_exchange_strong(none, SDL_GetPerformanceCounter());
+        }
+        if(r != Z_STREAM_END or z.avail_out != 0)
+            job->failed = true;
+    }
+    inflateEnd(&z);
+    return 0;
+}
+
+static char * gzip_parallel(const romimage & image, std::vector<gzmember> & members, uint32_t total, Uint64 & first_byte, inflatestats & stats)
+{
+    auto dst = (char *)malloc(total ? total : 1);
+    if(!dst) return nullptr;
+    
+    gzjob job;
+    job.image = &image;
+    job.dst = dst;
+    job.members = &members;
+    job.next = 0;
+    job.failed = false;
+    job.first_byte = 0;
+    
+    int count = SDL_GetCPUCount();
+    if(count > int(members.size())) count = members.size();
+    if(count < 1) count = 1;
+    std::vector<SDL_Thread *> threads;
+    for(int i = 1; i < count; i++)
+        if(auto t = SDL_CreateThread(gzip_worker, "ROM Inflate", &job))
+            threads.push_back(t);
+    gzip_worker(&job);
+    for(auto t : threads)
+        SDL_WaitThread(t, nullptr);
+    
+    stats.threads = threads.size()+1;
+    stats.members = members.size();
+    first_byte = job.first_byte;
+    if(job.failed) return free(dst), nullptr;
+    return dst;
+}
+
+// decompresses into a buffer that grows as needed; used when member sizes are unknown
+static char * inflate_stream(const unsigned char * src, uint32_t len, int windowbits, bool multimember, uint32_t & outsize, Uint64 & first_byte, uint32_t & members)
+{
+    uint32_t cap = len*2 > (1u<<20) ? len*2 : (1u<<20);
+    // gzip records the (mod 2^32) size of the last member in its trailer, which is exact for single-member files
+    if(windowbits > MAX_WBITS and le32(src+len-4) > cap) cap = le32(src+len-4);
+    auto dst = (char *)malloc(cap);
+    if(!dst) return nullptr;
+    
+    z_stream z = {};
+    if(inflateInit2(&z, windowbits) != Z_OK) return free(dst), nullptr;
+    z.next_in = (Bytef *)src;
+    z.avail_in = len;
+    uint32_t used = 0;
+    members = 0;
+    while(1)
+    {
+        if(used == cap)
+        {
+            if(cap >= UINT32_MAX/2) break;
+            auto bigger = (char *)realloc(dst, cap*2);
+            if(!bigger) break;
+            dst = bigger;
+            cap *= 2;
+        }
+        // bounded steps so progress (and the first byte) is observable
+        uint32_t step = cap - used < (1u<<20) ? cap - used : (1u<<20);
+        z.next_out = (Bytef *)dst + used;
+        z.avail_out = step;
+        auto r = inflate(&z, Z_NO_FLUSH);
+        used += step - z.avail_out;
+        if(used and !first_byte) first_byte = SDL_GetPerformanceCounter();
+        if(r == Z_STREAM_END)
+        {
+            members++;
+            // concatenated gzip members form one stream
+            if(multimember and z.avail_in >= 18 and z.next_in[0] == 0x1F and z.next_in[1] == 0x8B)
+            {
+                inflateReset(&z);
+                continue;
+            }
+            inflateEnd(&z);
+            outsize = used;
+            if(auto trimmed = (char *)realloc(dst, used ? used : 1)) dst = trimmed;
+            return dst;
+        }
+        if(r != Z_OK and r != Z_BUF_ERROR) break;
+        if(r == Z_BUF_ERROR and z.avail_in == 0) break; // truncated input
+    }
+    inflateEnd(&z);
+    free(dst);
+    return nullptr;
+}
+
+static bool is_rom_name(const unsigned char * name, uint32_t len)
+{
+    if(len < 4 or name[len-4] != '.') return false;
+    char ext[4] = {char(tolower(name[len-3])), char(tolower(name[len-2])), char(tolower(name[len-1])), 0};
+    return strcmp(ext, "z64") == 0 or strcmp(ext, "v64") == 0 or strcmp(ext, "n64") == 0;
+}
+
+static char * zip_extract(const romimage & image, uint32_t & outsize, Uint64 & first_byte, uint32_t & members)
+{
+    auto h = (const unsigned char *)image.data;
+    // end of central directory sits within the last 64KiB+22 bytes
+    int64_t eocd = -1;
+    for(int64_t i = int64_t(image.size) - 22; i >= 0 and i >= int64_t(image.size) - 22 - 0xFFFF; i--)
+        if(le32(h+i) == 0x06054B50) { eocd = i; break; }
+    if(eocd < 0) return puts("Zip archive has no central directory."), nullptr;
+    
+    uint32_t count = le16(h+eocd+10);
+    uint32_t dir = le32(h+eocd+16);
+    int64_t pick = -1;
+    uint32_t picksize = 0;
+    bool pickrom = false;
+    for(uint32_t n = 0, p = dir; n < count; n++)
+    {
+        if(p + 46 > image.size or le32(h+p) != 0x02014B50) return puts("Zip central directory is damaged."), nullptr;
+        uint32_t usize = le32(h+p+24);
+        uint32_t namelen = le16(h+p+28);
+        if(p + 46 + namelen > image.size) return puts("Zip central directory is damaged."), nullptr;
+        bool rom = is_rom_name(h+p+46, namelen);
+        if(pick < 0 or (rom and !pickrom) or (rom == pickrom and usize > picksize))
+        {
+            pick = p;
+            picksize = usize;
+            pickrom = rom;
+        }
+        p += 46 + namelen + le16(h+p+30) + le16(h+p+32);
+    }
+    if(pick < 0) return puts("Zip archive is empty."), nullptr;
+    
+    uint32_t method = le16(h+pick+10);
+    uint32_t csize = le32(h+pick+20);
+    uint32_t local = le32(h+pick+42);
+    if(local + 30 > image.size or le32(h+local) != 0x04034B50) return puts("Zip local header is damaged."), nullptr;
+    uint64_t data = uint64_t(local) + 30 + le16(h+local+26) + le16(h+local+28);
+    if(data + csize > image.size) return puts("Zip entry runs past the end of the archive."), nullptr;
+    
+    members = 1;
+    if(method == 0)
+    {
+        auto dst = (char *)malloc(csize ? csize : 1);
+        if(!dst) return nullptr;
+        memcpy(dst, h+data, csize);
+        first_byte = SDL_GetPerformanceCounter();
+        outsize = csize;
+        return dst;
+    }
+    if(method == 8)
+        return inflate_stream(h+data, csize, -MAX_WBITS, false, outsize, first_byte, members);
+    printf("Zip entry uses unsupported compression method %u.\n", method);
+    return nullptr;
+}
+
+int rom_decompress(romimage & image, int container, inflatestats & stats)
+{
+    auto start = SDL_GetPerformanceCounter();
+    Uint64 first_byte = 0;
+    uint32_t size = 0;
+    char * data = nullptr;
+    
+    if(container == ROM_GZIP)
+    {
+        std::vector<gzmember> members;
+        uint32_t total;
+        if(gzip_blocks(image, members, total) and members.size() > 1)
+        {
+            data = gzip_parallel(image, members, total, first_byte, stats);
+            size = total;
+        }
+        else
+            data = inflate_stream((const unsigned char *)image.data, image.size, 16+MAX_WBITS, true, size, first_byte, stats.members);
+    }
+    else if(container == ROM_ZIP)
+        data = zip_extract(image, size, first_byte, stats.members);
+    else
+        return 0;
+    
+    if(!data or size == 0)
+        return free(data), puts("Failed to decompress ROM."), -1;
+    
+    stats.first_byte_ms = first_byte ? ms_between(start, first_byte) : 0;
+    stats.total_ms = ms_between(start, SDL_GetPerformanceCounter());
+    
+    rom_unmap(image);
+    image.data = data;
+    image.size = size;
+    image.mapped = false;
+    return 0;
+}
@@ -0,0 +1,57 @@
+#include <stdint.h>
+#include <stdio.h>
+
+struct romimage {
+    char * data = nullptr;
+    uint32_t size = 0;
+    // true if data is a file mapping rather than a heap buffer
+    bool mapped = false;
+};
+
+// maps the whole file read-only (falls back to a single fread where mmap is unavailable)
+// returns 0 on success and prints its own errors
+int rom_map(romimage & image, const char * fname);
+// asks the OS to start paging the image in ahead of the core's copy
+void rom_prefetch(romimage & image);
+void rom_unmap(romimage & image);
+
+// byte order of a dump, detected from the first word of the header
+enum {
+    ROM_Z64, // big endian, what the core wants
+    ROM_V64, // 16-bit byteswapped
+    ROM_N64, // 32-bit byteswapped (little endian)
+    ROM_UNKNOWN
+};
+
+int rom_byteorder(const romimage & image);
+// rewrites the image into z64 order in place; mapped images become private copy-on-write pages
+int rom_normalize(romimage & image, int order);
+// kernels used by rom_normalize, exposed for benchmarking; len is in bytes, trailing partial units are left alone
+void rom_swap16(char * data, uint32_t len);
+void rom_swap32(char * data, uint32_t len);
+
+uint64_t rom_hash64(const char * data, uint32_t len);
+// normalized images are kept as <dir>/<hash>.z64
+// lookup replaces image with the cached mapping and returns 0 if there is one
+int rom_cache_lookup(romimage & image, const char * dir, uint64_t hash);
+int rom_cache_store(const romimage & image, const char * dir, uint64_t hash);
+
+// compression container wrapping a dump, detected from its magic
+enum {
+    ROM_RAW,
+    ROM_GZIP,
+    ROM_ZIP
+};
+
+struct inflatestats {
+    double first_byte_ms = 0; // from start of decompression until the first output bytes exist
+    double total_ms = 0;
+    uint32_t members = 0; // gzip members or zip entries inflated
+    int threads = 1;
+};
+
+int rom_container(const romimage & image);
+// replaces a compressed image with a heap buffer holding its contents
+// blocked gzip (BGZF-style members that record their compressed size) is inflated across threads,
+// other gzip files stream member by member, and zip archives inflate the ROM entry (or the largest one)
+int rom_decompress(romimage & image, int container, inflatestats & stats);
@@ -0,0 +1,227 @@
+#include "romid.hpp"
+#include "rom.hpp"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include <SDL2/SDL.h>
+#include <zlib.h>
+
+#define CHUNK_SIZE (1u<<20)
+
+// MD5 (RFC 1321)
+
+struct md5state {
+    uint32_t h[4] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476};
+};
+
+static const uint32_t md5_k[64] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+    0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+    0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+    0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+    0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+static const uint8_t md5_r[64] = {
+    7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+    5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20,
+    4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+    6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+};
+
+static void md5_block(md5state & s, const unsigned char * p)
+{
+    uint32_t w[16];
+    for(int i = 0; i < 16; i++)
+        w[i] = p[i*4] | p[i*4+1]<<8 | p[i*4+2]<<16 | uint32_t(p[i*4+3])<<24;
+    uint32_t a = s.h[0], b = s.h[1], c = s.h[2], d = s.h[3];
+    for(int i = 0; i < 64; i++)
+    {
+        uint32_t f, g;
+        if     (i < 16) f = (b & c) | (~b & d), g = i;
+        else if(i < 32) f = (d & b) | (~d & c), g = (5*i + 1) & 15;
+        else if(i < 48) f = b ^ c ^ d,          g = (3*i + 5) & 15;
+        else            f = c ^ (b | ~d),       g = (7*i) & 15;
+        f += a + md5_k[i] + w[g];
+        a = d; d = c; c = b;
+        b += (f << md5_r[i]) | (f >> (32 - md5_r[i]));
+    }
+    s.h[0] += a; s.h[1] += b; s.h[2] += c; s.h[3] += d;
+}
+
+static void md5(const char * data, uint32_t size, char * hex)
+{
+    md5state s;
+    auto p = (const unsigned char *)data;
+    uint32_t i = 0;
+    for(; i+64 <= size; i += 64)
+        md5_block(s, p+i);
+    
+    unsigned char tail[128] = {};
+    uint32_t rest = size - i;
+    memcpy(tail, p+i, rest);
+    tail[rest] = 0x80;
+    uint32_t len = rest < 56 ? 64 : 128;
+    uint64_t bits = uint64_t(size) * 8;
+    for(int b = 0; b < 8; b++)
+        tail[len-8+b] = bits >> (b*8);
+    md5_block(s, tail);
+    if(len == 128) md5_block(s, tail+64);
+    
+    for(int n = 0; n < 16; n++)
+        sprintf(hex + n*2, "%02x", (s.h[n/4] >> ((n%4)*8)) & 0xFF);
+}
+
+// parallel stage
+
+struct hashjob {
+    const char * data;
+    uint32_t size;
+    uint32_t chunks;
+    std::atomic<uint32_t> next;
+    std::vector<uint32_t> crcs;
+    std::vector<uint64_t> hashes;
+};
+
+static int chunk_worker(void * ptr)
+{
+    auto job = (hashjob *)ptr;
+    for(uint32_t n; (n = job->next++) < job->chunks; )
+    {
+        uint32_t start = n * CHUNK_SIZE;
+        uint32_t len = job->size - start < CHUNK_SIZE ? job->size - start : CHUNK_SIZE;
+        job->crcs[n] = crc32(0, (const Bytef *)job->data + start, len);
+        job->hashes[n] = rom_hash64(job->data + start, len);
+    }
+    return 0;
+}
+
+struct md5job {
+    const char * data;
+    uint32_t size;
+    char * hex;
+};
+
+static int md5_worker(void * ptr)
+{
+    auto job = (md5job *)ptr;
+    md5(job->data, job->size, job->hex);
+    return 0;
+}
+
+void romid_compute(romidentity & id, const char * data, uint32_t size)
+{
+    hashjob job;
+    job.data = data;
+    job.size = size;
+    job.chunks = (size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    job.next = 0;
+    job.crcs.resize(job.chunks);
+    job.hashes.resize(job.chunks);
+    
+    md5job digest = {data, size, id.md5};
+    auto md5thread = SDL_CreateThread(md5_worker, "ROM MD5", &digest);
+    if(!md5thread) md5_worker(&digest);
+    
+    std::vector<SDL_Thread *> threads;
+    for(int i = 2; i < SDL_GetCPUCount(); i++)
+        if(auto t = SDL_CreateThread(chunk_worker, "ROM Hash", &job))
+            threads.push_back(t);
+    chunk_worker(&job);
+    for(auto t : threads)
+        SDL_WaitThread(t, nullptr);
+    
+    // CRC32 of the whole image is recovered from the per-chunk values
+    uint32_t crc = crc32(0, nullptr, 0);
+    for(uint32_t n = 0; n < job.chunks; n++)
+    {
+        uint32_t len = size - n*CHUNK_SIZE < CHUNK_SIZE ? size - n*CHUNK_SIZE : CHUNK_SIZE;
+        crc = crc32_combine(crc, job.crcs[n], len);
+    }
+    id.crc32 = crc;
+    id.hash64 = rom_hash64((const char *)job.hashes.data(), job.chunks * sizeof(uint64_t)) ^ size;
+    
+    if(md5thread) SDL_WaitThread(md5thread, nullptr);
+    id.valid = true;
+}
+
+// index
+
+static bool file_stamp(const char * path, uint64_t & size, int64_t & mtime)
+{
+    struct stat info;
+    if(stat(path, &info) != 0) return false;
+    size = info.st_size;
+    mtime = info.st_mtime;
+    return true;
+}
+
+int romid_index_lookup(const char * index, const char * path, romidentity & id)
+{
+    uint64_t size;
+    int64_t mtime;
+    if(!file_stamp(path, size, mtime)) return -1;
+    
+    FILE * f = fopen(index, "r");
+    if(!f) return -1;
+    bool found = false;
+    char line[4096+128];
+    while(fgets(line, sizeof(line), f))
+    {
+        unsigned long long lsize, lhash;
+        long long lmtime;
+        unsigned lcrc;
+        char lmd5[33];
+        int pathstart = 0;
+        if(sscanf(line, "%llu %lld %x %32s %llx %n", &lsize, &lmtime, &lcrc, lmd5, &lhash, &pathstart) < 5 or !pathstart) continue;
+        line[strcspn(line, "\r\n")] = 0;
+        if(strcmp(line+pathstart, path) != 0) continue;
+        // keep scanning; a later line for the same path supersedes this one
+        found = lsize == size and lmtime == mtime;
+        if(found)
+        {
+            id.crc32 = lcrc;
+            memcpy(id.md5, lmd5, 33);
+            id.hash64 = lhash;
+            id.valid = true;
+        }
+    }
+    fclose(f);
+    return found ? 0 : -1;
+}
+
+int romid_index_store(const char * index, const char * path, const romidentity & id)
+{
+    uint64_t size;
+    int64_t mtime;
+    if(!id.valid or !file_stamp(path, size, mtime)) return -1;
+    #ifndef _WIN32
+    if(auto slash = strrchr(index, '/'))
+    {
+        std::string parent(index, slash - index);
+        mkdir(parent.c_str(), 0755);
+    }
+    #endif //  _WIN32
+    FILE * f = fopen(index, "a");
+    if(!f) return -1;
+    fprintf(f, "%llu %lld %08x %s %016llx %s\n", (unsigned long long)size, (long long)mtime, id.crc32, id.md5, (unsigned long long)id.hash64, path);
+    return fclose(f);
+}
+
+void romid_gamepath(char * out, size_t len, const char * dir, const romidentity & id, const char * name)
+{
+    snprintf(out, len, "%s/%016llX", dir, (unsigned long long)id.hash64);
+    #ifndef _WIN32
+    mkdir(dir, 0755);
+    mkdir(out, 0755);
+    #endif //  _WIN32
+    auto used = strlen(out);
+    snprintf(out+used, len-used, "/%s", name);
+}
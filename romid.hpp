@@ -0,0 +1,22 @@
+#include <stdint.h>
+#include <stdio.h>
+
+// identity of a ROM image in z64 byte order
+struct romidentity {
+    uint32_t crc32 = 0;
+    char md5[33] = {}; // lowercase hex; m64p_rom_settings::MD5 is the same digest in uppercase, so compare with strcasecmp
+    uint64_t hash64 = 0; // rom_hash64 of each 1MiB chunk, then of the list of chunk hashes
+    bool valid = false;
+};
+
+// hashes the image on all cores: CRC32 and hash64 are split by chunk, MD5 runs alongside on its own thread
+void romid_compute(romidentity & id, const char * data, uint32_t size);
+
+// the index is a text file of "size mtime crc32 md5 hash64 path" lines; later lines win
+// lookup returns 0 and fills id if the file at path still has the size and mtime it had when stored
+int romid_index_lookup(const char * index, const char * path, romidentity & id);
+int romid_index_store(const char * index, const char * path, const romidentity & id);
+
+// per-game files live at <dir>/<hash64>/<name>, so anything keyed to a ROM is found without searching
+// creates the directory if needed
+void romid_gamepath(char * out, size_t len, const char * dir, const romidentity & id, const char * name);
@@ -0,0 +1,303 @@
+#include "scan.hpp"
+#include "rdram.hpp"
+
+#include <string.h>
+#include <algorithm>
+
+#include <SDL2/SDL.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define SCAN_X86
+#endif
+
+uint32_t scanner::width()
+{
+    return type == SCAN_U8 ? 1 : type == SCAN_U16 ? 2 : 4;
+}
+
+uint32_t scanner::elements()
+{
+    return RDRAM_SIZE / width();
+}
+
+void scanner::capture(const uint32_t * rdram)
+{
+    current.resize(RDRAM_SIZE/4);
+    memcpy(current.data(), rdram, RDRAM_SIZE);
+    want_capture = false;
+    captured = true;
+}
+
+void scanner::start(int type)
+{
+    this->type = type;
+    previous.swap(current);
+    candidates.assign(elements()/64, ~uint64_t(0));
+    count = elements();
+    fresh = true;
+    active = true;
+}
+
+template<typename T>
+static bool test(int mode, T v, T prev, T lo, T hi)
+{
+    switch(mode)
+    {
+    case SCAN_EXACT:     return v == lo;
+    case SCAN_RANGE:     return lo <= v and v <= hi;
+    case SCAN_CHANGED:   return v != prev;
+    case SCAN_UNCHANGED: return v == prev;
+    case SCAN_INCREASED: return v > prev;
+    case SCAN_DECREASED: return v < prev;
+    }
+    return false;
+}
+
+struct scanjob {
+    int mode;
+    scanvalue lo, hi;
+    const void * cur;
+    const void * prev;
+    uint64_t * bits;
+    uint32_t first, last; // bitmap words
+    uint32_t found;
+    bool dense;
+};
+
+// dense passes: every element of every word in range gets tested
+
+template<typename T>
+static uint64_t dense_scalar(const T * cur, const T * prev, int mode, T lo, T hi)
+{
+    uint64_t mask = 0;
+    for(int i = 0; i < 64; i++)
+        mask |= uint64_t(test(mode, cur[i], prev[i], lo, hi)) << i;
+    return mask;
+}
+
+#ifdef SCAN_X86
+
+// per-width AVX2 operations; ge is unsigned a >= b
+struct avx_u8 {
+    __attribute__((target("avx2"))) static __m256i set(uint32_t v) { return _mm256_set1_epi8(char(v)); }
+    __attribute__((target("avx2"))) static __m256i eq(__m256i a, __m256i b) { return _mm256_cmpeq_epi8(a, b); }
+    __attribute__((target("avx2"))) static __m256i ge(__m256i a, __m256i b) { return _mm256_cmpeq_epi8(_mm256_max_epu8(a, b), a); }
+};
+struct avx_u16 {
+    __attribute__((target("avx2"))) static __m256i set(uint32_t v) { return _mm256_set1_epi16(short(v)); }
+    __attribute__((target("avx2"))) static __m256i eq(__m256i a, __m256i b) { return _mm256_cmpeq_epi16(a, b); }
+    __attribute__((target("avx2"))) static __m256i ge(__m256i a, __m256i b) { return _mm256_cmpeq_epi16(_mm256_max_epu16(a, b), a); }
+};
+struct avx_u32 {
+    __attribute__((target("avx2"))) static __m256i set(uint32_t v) { return _mm256_set1_epi32(int(v)); }
+    __attribute__((target("avx2"))) static __m256i eq(__m256i a, __m256i b) { return _mm256_cmpeq_epi32(a, b); }
+    __attribute__((target("avx2"))) static __m256i ge(__m256i a, __m256i b) { return _mm256_cmpeq_epi32(_mm256_max_epu32(a, b), a); }
+};
+
+template<typename ops>
+__attribute__((target("avx2")))
+static __m256i compare(int mode, __m256i v, __m256i p, __m256i lo, __m256i hi)
+{
+    auto ones = _mm256_set1_epi8(-1);
+    switch(mode)
+    {
+    case SCAN_EXACT:     return ops::eq(v, lo);
+    case SCAN_RANGE:     return _mm256_and_si256(ops::ge(v, lo), ops::ge(hi, v));
+    case SCAN_CHANGED:   return _mm256_xor_si256(ops::eq(v, p), ones);
+    case SCAN_UNCHANGED: return ops::eq(v, p);
+    case SCAN_INCREASED: return _mm256_xor_si256(ops::ge(p, v), ones);
+    case SCAN_DECREASED: return _mm256_xor_si256(ops::ge(v, p), ones);
+    }
+    return _mm256_setzero_si256();
+}
+
+__attribute__((target("avx2")))
+static uint64_t dense_avx2(int type, const void * cur, const void * prev, int mode, scanvalue lo, scanvalue hi)
+{
+    auto c = (const __m256i *)cur;
+    auto p = (const __m256i *)prev;
+    #define LOAD(v, i) _mm256_loadu_si256(v+i)
+    if(type == SCAN_U8)
+    {
+        auto l = avx_u8::set(lo.u), h = avx_u8::set(hi.u);
+        uint64_t m0 = uint32_t(_mm256_movemask_epi8(compare<avx_u8>(mode, LOAD(c,0), LOAD(p,0), l, h)));
+        uint64_t m1 = uint32_t(_mm256_movemask_epi8(compare<avx_u8>(mode, LOAD(c,1), LOAD(p,1), l, h)));
+        return m0 | m1 << 32;
+    }
+    if(type == SCAN_U16)
+    {
+        auto l = avx_u16::set(lo.u), h = avx_u16::set(hi.u);
+        uint64_t mask = 0;
+        for(int half = 0; half < 2; half++)
+        {
+            auto r0 = compare<avx_u16>(mode, LOAD(c,half*2), LOAD(p,half*2), l, h);
+            auto r1 = compare<avx_u16>(mode, LOAD(c,half*2+1), LOAD(p,half*2+1), l, h);
+            // pack to one byte per element; packs works per 128-bit lane, so put the lanes back in order
+            auto packed = _mm256_permute4x64_epi64(_mm256_packs_epi16(r0, r1), 0xD8);
+            mask |= uint64_t(uint32_t(_mm256_movemask_epi8(packed))) << (half*32);
+        }
+        return mask;
+    }
+    uint64_t mask = 0;
+    if(type == SCAN_U32)
+    {
+        auto l = avx_u32::set(lo.u), h = avx_u32::set(hi.u);
+        for(int i = 0; i < 8; i++)
+            mask |= uint64_t(_mm256_movemask_ps(_mm256_castsi256_ps(compare<avx_u32>(mode, LOAD(c,i), LOAD(p,i), l, h)))) << (i*8);
+        return mask;
+    }
+    auto l = _mm256_set1_ps(lo.f), h = _mm256_set1_ps(hi.f);
+    for(int i = 0; i < 8; i++)
+    {
+        auto v = _mm256_loadu_ps((const float *)cur + i*8);
+        auto q = _mm256_loadu_ps((const float *)prev + i*8);
+        __m256 r = _mm256_setzero_ps();
+        switch(mode)
+        {
+        case SCAN_EXACT:     r = _mm256_cmp_ps(v, l, _CMP_EQ_OQ); break;
+        case SCAN_RANGE:     r = _mm256_and_ps(_mm256_cmp_ps(v, l, _CMP_GE_OQ), _mm256_cmp_ps(v, h, _CMP_LE_OQ)); break;
+        case SCAN_CHANGED:   r = _mm256_cmp_ps(v, q, _CMP_NEQ_UQ); break;
+        case SCAN_UNCHANGED: r = _mm256_cmp_ps(v, q, _CMP_EQ_OQ); break;
+        case SCAN_INCREASED: r = _mm256_cmp_ps(v, q, _CMP_GT_OQ); break;
+        case SCAN_DECREASED: r = _mm256_cmp_ps(v, q, _CMP_LT_OQ); break;
+        }
+        mask |= uint64_t(_mm256_movemask_ps(r)) << (i*8);
+    }
+    #undef LOAD
+    return mask;
+}
+
+#endif //  SCAN_X86
+
+static uint64_t dense_word(int type, const void * cur, const void * prev, int mode, scanvalue lo, scanvalue hi)
+{
+    #ifdef SCAN_X86
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    if(avx2) return dense_avx2(type, cur, prev, mode, lo, hi);
+    #endif //  SCAN_X86
+    switch(type)
+    {
+    case SCAN_U8:  return dense_scalar((const uint8_t *)cur, (const uint8_t *)prev, mode, uint8_t(lo.u), uint8_t(hi.u));
+    case SCAN_U16: return dense_scalar((const uint16_t *)cur, (const uint16_t *)prev, mode, uint16_t(lo.u), uint16_t(hi.u));
+    case SCAN_U32: return dense_scalar((const uint32_t *)cur, (const uint32_t *)prev, mode, lo.u, hi.u);
+    default:       return dense_scalar((const float *)cur, (const float *)prev, mode, lo.f, hi.f);
+    }
+}
+
+// sparse passes: only elements whose bit is still set get tested
+
+template<typename T>
+static uint64_t sparse_word(uint64_t bits, const T * cur, const T * prev, int mode, T lo, T hi)
+{
+    uint64_t keep = bits;
+    while(bits)
+    {
+        int i = __builtin_ctzll(bits);
+        bits &= bits-1;
+        if(!test(mode, cur[i], prev[i], lo, hi))
+            keep &= ~(uint64_t(1) << i);
+    }
+    return keep;
+}
+
+template<typename T>
+static void run_job(scanjob & job, int type)
+{
+    auto cur = (const T *)job.cur;
+    auto prev = (const T *)job.prev;
+    T lo, hi;
+    if(type == SCAN_FLOAT) memcpy(&lo, &job.lo.f, sizeof(T)), memcpy(&hi, &job.hi.f, sizeof(T));
+    else lo = T(job.lo.u), hi = T(job.hi.u);
+    uint32_t found = 0;
+    for(uint32_t w = job.first; w < job.last; w++)
+    {
+        auto & bits = job.bits[w];
+        if(job.dense)
+            bits = dense_word(type, cur + w*64, prev + w*64, job.mode, job.lo, job.hi);
+        else if(bits)
+            bits = sparse_word(bits, cur + w*64, prev + w*64, job.mode, lo, hi);
+        found += __builtin_popcountll(bits);
+    }
+    job.found = found;
+}
+
+struct scanthread {
+    scanjob * job;
+    int type;
+};
+
+static int scan_worker(void * ptr)
+{
+    auto t = (scanthread *)ptr;
+    switch(t->type)
+    {
+    case SCAN_U8:  run_job<uint8_t>(*t->job, t->type); break;
+    case SCAN_U16: run_job<uint16_t>(*t->job, t->type); break;
+    case SCAN_U32: run_job<uint32_t>(*t->job, t->type); break;
+    default:       run_job<float>(*t->job, t->type); break;
+    }
+    return 0;
+}
+
+uint32_t scanner::filter(int mode, scanvalue lo, scanvalue hi)
+{
+    auto start = SDL_GetPerformanceCounter();
+    
+    int count_threads = SDL_GetCPUCount();
+    if(count_threads < 1) count_threads = 1;
+    if(count_threads > 16) count_threads = 16;
+    uint32_t words = candidates.size();
+    
+    std::vector<scanjob> jobs(count_threads);
+    std::vector<scanthread> args(count_threads);
+    std::vector<SDL_Thread *> threads;
+    // threads own whole bitmap words, so nothing is shared between them
+    for(int i = 0; i < count_threads; i++)
+    {
+        jobs[i] = {mode, lo, hi, current.data(), previous.data(), candidates.data(), words*i/count_threads, words*(i+1)/count_threads, 0, fresh};
+        args[i] = {&jobs[i], type};
+    }
+    for(int i = 1; i < count_threads; i++)
+    {
+        if(auto t = SDL_CreateThread(scan_worker, "RDRAM Scan", &args[i]))
+            threads.push_back(t);
+        else
+            scan_worker(&args[i]);
+    }
+    scan_worker(&args[0]);
+    for(auto t : threads)
+        SDL_WaitThread(t, nullptr);
+    
+    count = 0;
+    for(auto & j : jobs)
+        count += j.found;
+    fresh = false;
+    previous.swap(current);
+    
+    last_ms = (SDL_GetPerformanceCounter()-start)*1000.0/SDL_GetPerformanceFrequency();
+    return count;
+}
+
+void scanner::results(std::vector<uint32_t> & addresses, std::vector<uint32_t> & values, uint32_t max)
+{
+    addresses.clear();
+    values.clear();
+    auto base = (const uint8_t *)previous.data();
+    for(uint32_t w = 0; w < candidates.size() and addresses.size() < max; w++)
+    {
+        for(auto bits = candidates[w]; bits and addresses.size() < max; bits &= bits-1)
+        {
+            uint32_t i = w*64 + __builtin_ctzll(bits);
+            uint32_t addr, value;
+            if(type == SCAN_U8)
+                addr = i ^ RDRAM_BYTE_SWIZZLE, value = base[i];
+            else if(type == SCAN_U16)
+                addr = (i ^ RDRAM_HALF_SWIZZLE) * 2, value = ((const uint16_t *)base)[i];
+            else
+                addr = i * 4, value = ((const uint32_t *)base)[i];
+            addresses.push_back(0x80000000 | addr);
+            values.push_back(value);
+        }
+    }
+}
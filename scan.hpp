@@ -0,0 +1,61 @@
+#include <stdint.h>
+#include <vector>
+#include <atomic>
+
+// value types the scanner understands
+enum {
+    SCAN_U8,
+    SCAN_U16,
+    SCAN_U32,
+    SCAN_FLOAT
+};
+
+// filters; the relative ones compare against the snapshot from the previous pass
+enum {
+    SCAN_EXACT,
+    SCAN_RANGE,
+    SCAN_CHANGED,
+    SCAN_UNCHANGED,
+    SCAN_INCREASED,
+    SCAN_DECREASED
+};
+
+// both ends are read according to the scan type; exact uses lo only
+struct scanvalue {
+    uint32_t u = 0;
+    float f = 0;
+};
+
+// Cheat-search style value scanner over all of RDRAM.
+// Elements are aligned values of the scan type. Because RDRAM is kept as host-order words, element i
+// of the host array is N64 address (i ^ 3) for bytes and ((i ^ 1) * 2) for halfwords, so the
+// comparisons can run straight over the host array. The first pass after start() compares the
+// whole block with AVX2 (when available) split across threads; later passes only visit elements
+// still set in the candidate bitmap.
+struct scanner {
+    int type = SCAN_U32;
+    bool active = false;
+    std::vector<uint32_t> previous;
+    std::vector<uint32_t> current;
+    std::vector<uint64_t> candidates; // one bit per element
+    uint32_t count = 0;
+    bool fresh = true; // every element is still a candidate
+    double last_ms = 0;
+    
+    // a frame-synchronized copy of RDRAM is requested by the UI and filled by the emulation thread
+    std::atomic<bool> want_capture{false};
+    std::atomic<bool> captured{false};
+    
+    uint32_t elements();
+    uint32_t width();
+    
+    // copies RDRAM into current; only by the thread that cleared want_capture with exchange()
+    void capture(const uint32_t * rdram);
+    // starts over with every element a candidate; current must already hold a capture
+    void start(int type);
+    // filters candidates using current against previous, then keeps current as the new previous
+    uint32_t filter(int mode, scanvalue lo, scanvalue hi);
+    
+    // N64 address and value of the first max candidates
+    void results(std::vector<uint32_t> & addresses, std::vector<uint32_t> & values, uint32_t max);
+};
@@ -0,0 +1,88 @@
+#include "screen.hpp"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+void screenbuffer::begin()
+{
+    int nh, nw;
+    getmaxyx(stdscr, nh, nw);
+    if(nh != h or nw != w)
+    {
+        h = nh;
+        w = nw;
+        back.assign(size_t(h)*w, ' ');
+        // nothing on the terminal can be trusted after a resize
+        front.assign(size_t(h)*w, 0);
+        clearok(curscr, TRUE);
+    }
+    std::fill(back.begin(), back.end(), chtype(' '));
+    cy = cx = 0;
+    right = w;
+    attr = A_NORMAL;
+}
+
+void screenbuffer::at(int y, int x)
+{
+    cy = y;
+    cx = x;
+}
+
+void screenbuffer::style(chtype a)
+{
+    attr = a;
+}
+
+void screenbuffer::limit(int x)
+{
+    right = x < w ? x : w;
+}
+
+void screenbuffer::put(chtype c)
+{
+    if(cy >= 0 and cy < h and cx >= 0 and cx < right)
+        back[size_t(cy)*w + cx] = c | attr;
+    cx++;
+}
+
+void screenbuffer::text(const char * str)
+{
+    for(; *str; str++)
+        put((unsigned char)*str);
+}
+
+void screenbuffer::format(const char * format, ...)
+{
+    char buffer[1024];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    text(buffer);
+}
+
+void screenbuffer::fill(chtype c, int n)
+{
+    int x = cx;
+    for(int i = 0; i < n; i++)
+        put(c);
+    cx = x;
+}
+
+int screenbuffer::present()
+{
+    int sent = 0;
+    for(int y = 0; y < h; y++)
+    {
+        auto line = &back[size_t(y)*w];
+        auto old = &front[size_t(y)*w];
+        if(memcmp(line, old, w*sizeof(chtype)) == 0) continue;
+        mvaddchnstr(y, 0, line, w);
+        memcpy(old, line, w*sizeof(chtype));
+        sent++;
+    }
+    refresh();
+    return sent;
+}
@@ -0,0 +1,31 @@
+#include <ncurses.h>
+#include <vector>
+
+// Back buffer for the curses screen. The UI draws a whole frame into it with curses-like calls,
+// then present() compares each line with what was put on the terminal last time and only sends
+// the lines that differ, each as one addchnstr. Nothing is cleared between frames.
+struct screenbuffer {
+    int h = 0, w = 0;
+    std::vector<chtype> back;
+    std::vector<chtype> front;
+    int cy = 0, cx = 0;
+    int right = 0; // writes at or past this column are dropped
+    chtype attr = A_NORMAL;
+    
+    // starts a frame: picks up the terminal size and blanks the back buffer
+    void begin();
+    
+    void at(int y, int x);
+    void style(chtype a);
+    // clips later writes to columns left of x; begin() resets it to the full width
+    void limit(int x);
+    // writes at the cursor and advances it; characters past the right edge are dropped
+    void put(chtype c);
+    void text(const char * str);
+    void format(const char * format, ...);
+    // fills n cells from the cursor without moving it, like curses hline
+    void fill(chtype c, int n);
+    
+    // writes changed lines and refreshes; returns how many lines were sent
+    int present();
+};
@@ -0,0 +1,67 @@
+#include "spark.hpp"
+
+#define SHIFT(k) (2*(k)) // level k buckets hold 1 << SHIFT(k) samples
+
+sparkhistory::sparkhistory()
+{
+    for(auto & level : levels)
+        level.assign(SPARK_BUCKETS, {0, 0});
+}
+
+void sparkhistory::push(float value)
+{
+    uint64_t n = count++;
+    for(int k = 0; k < SPARK_LEVELS; k++)
+    {
+        uint64_t size = uint64_t(1) << SHIFT(k);
+        auto & p = pending[k];
+        if((n & (size-1)) == 0)
+            p = {value, value};
+        else
+        {
+            if(value < p.lo) p.lo = value;
+            if(value > p.hi) p.hi = value;
+        }
+        if(((n+1) & (size-1)) == 0)
+            levels[k][(n >> SHIFT(k)) & (SPARK_BUCKETS-1)] = p;
+    }
+}
+
+void sparkhistory::columns(uint32_t span, int width, sparkbucket * out)
+{
+    if(width <= 0) return;
+    // finest level whose buckets don't outnumber the columns more than 4 to 1 and that reaches back far enough
+    int k = 0;
+    while(k < SPARK_LEVELS-1 and ((uint64_t(4) << SHIFT(k)) * width <= span or (uint64_t(SPARK_BUCKETS) << SHIFT(k)) < span))
+        k++;
+    uint64_t complete = count >> SHIFT(k);
+    bool partial = count & ((uint64_t(1) << SHIFT(k)) - 1);
+    uint64_t oldest = complete > SPARK_BUCKETS ? complete - SPARK_BUCKETS : 0;
+
+    int64_t start = int64_t(count) - span;
+    for(int c = 0; c < width; c++)
+    {
+        int64_t s0 = start + int64_t(span) * c / width;
+        int64_t s1 = start + int64_t(span) * (c+1) / width;
+        if(s1 <= s0) s1 = s0 + 1;
+        sparkbucket b = {1, 0};
+        if(s1 > 0)
+        {
+            uint64_t b0 = s0 > 0 ? uint64_t(s0) >> SHIFT(k) : 0;
+            uint64_t b1 = (uint64_t(s1) + (uint64_t(1) << SHIFT(k)) - 1) >> SHIFT(k);
+            if(b0 < oldest) b0 = oldest;
+            bool any = false;
+            for(uint64_t i = b0; i < b1; i++)
+            {
+                const sparkbucket * from;
+                if(i < complete) from = &levels[k][i & (SPARK_BUCKETS-1)];
+                else if(i == complete and partial) from = &pending[k];
+                else break;
+                if(!any or from->lo < b.lo) b.lo = from->lo;
+                if(!any or from->hi > b.hi) b.hi = from->hi;
+                any = true;
+            }
+        }
+        out[c] = b;
+    }
+}
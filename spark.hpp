@@ -0,0 +1,28 @@
+#include <stdint.h>
+#include <vector>
+
+// Recent history of one watch, kept for drawing at any zoom.
+// Level k holds min/max buckets of 4^k samples in a ring of SPARK_BUCKETS, so every level reaches
+// SPARK_BUCKETS * 4^k samples back and the coarsest covers hours at 60 frames per second. Each push
+// folds the sample into one bucket per level. A query picks the finest level that has both enough
+// history and at most a few buckets per output column, so its cost depends only on the width
+// asked for, not on how much time it spans.
+
+#define SPARK_LEVELS 7
+#define SPARK_BUCKETS 1024 // power of two
+
+struct sparkbucket {
+    float lo, hi;
+};
+
+struct sparkhistory {
+    std::vector<sparkbucket> levels[SPARK_LEVELS];
+    sparkbucket pending[SPARK_LEVELS]; // bucket still filling, per level
+    uint64_t count = 0; // samples pushed
+
+    sparkhistory();
+    void push(float value);
+    // min/max of each of width equal slices of the last span samples, newest on the right;
+    // slices before the first sample come back with lo > hi
+    void columns(uint32_t span, int width, sparkbucket * out);
+};
@@ -0,0 +1,76 @@
+#include "statefile.hpp"
+
+#include <stdio.h>
+#include <atomic>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <unistd.h>
+#endif //  __linux__
+
+static std::atomic<int> statejob{STATEJOB_NONE};
+
+bool statefile_open(statefile & f, const char * name)
+{
+    #ifdef __linux__
+    f.fd = memfd_create(name, 0);
+    if(f.fd >= 0)
+    {
+        snprintf(f.path, sizeof(f.path), "/proc/self/fd/%d", f.fd);
+        return true;
+    }
+    #endif //  __linux__
+    snprintf(f.path, sizeof(f.path), "%s.tmp", name);
+    FILE * file = fopen(f.path, "wb");
+    return file and fclose(file) == 0;
+}
+
+void statefile_close(statefile & f)
+{
+    #ifdef __linux__
+    if(f.fd >= 0) close(f.fd);
+    #endif //  __linux__
+    if(f.fd < 0 and f.path[0]) remove(f.path);
+    f.fd = -1;
+    f.path[0] = 0;
+}
+
+bool statefile_read(const statefile & f, std::vector<uint8_t> & out)
+{
+    FILE * file = fopen(f.path, "rb");
+    if(!file) return false;
+    bool ok = fseek(file, 0, SEEK_END) == 0;
+    long size = ok ? ftell(file) : -1;
+    ok = size > 0 and fseek(file, 0, SEEK_SET) == 0;
+    if(ok)
+    {
+        out.resize(size);
+        ok = fread(out.data(), 1, size, file) == size_t(size);
+    }
+    fclose(file);
+    return ok;
+}
+
+bool statefile_write(const statefile & f, const uint8_t * data, size_t size)
+{
+    FILE * file = fopen(f.path, "wb");
+    if(!file) return false;
+    bool ok = fwrite(data, 1, size, file) == size;
+    return fclose(file) == 0 and ok;
+}
+
+bool statejob_claim(int owner)
+{
+    int none = STATEJOB_NONE;
+    return statejob.compare_exchange_strong(none, owner);
+}
+
+void statejob_release(int owner)
+{
+    statejob.compare_exchange_strong(owner, STATEJOB_NONE);
+}
+
+bool statejob_held(int owner)
+{
+    return statejob == owner;
+}
@@ -0,0 +1,35 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+// the core's uncompressed Project64 format; its own format is a zip archive, which scatters any
+// change over the whole file
+#define STATE_PJ64_UNCOMPRESSED 3
+
+// who has a savestate job with the core
+enum {
+    STATEJOB_NONE,
+    STATEJOB_REWIND,
+    STATEJOB_REVERSE
+};
+
+// A file the core can fopen for a savestate the frontend takes for itself; in memory where the OS
+// allows it (memfd on Linux), so the core's fwrite is a memcpy.
+struct statefile {
+    char path[64] = "";
+    int fd = -1; // -1 when the file is on disk
+};
+
+// false if neither a memfd nor a file can be had
+bool statefile_open(statefile & f, const char * name);
+void statefile_close(statefile & f);
+bool statefile_read(const statefile & f, std::vector<uint8_t> & out);
+bool statefile_write(const statefile & f, const uint8_t * data, size_t size);
+
+// The core keeps one savestate job at a time, does it at its next interrupt and reports back without
+// saying whose it was, and a second request replaces the first. Whoever asks for a save or load
+// claims the job first and gives it back once the core has answered, so the answer always has one
+// owner to go to.
+bool statejob_claim(int owner); // false while someone else holds it
+void statejob_release(int owner);
+bool statejob_held(int owner);
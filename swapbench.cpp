@@ -0,0 +1,81 @@
+// swapbench: times the byte order kernels rom_normalize uses against a plain per-byte loop.
+//   swapbench [MiB] [runs]        defaults to a 64 MiB image and 5 runs, reports the best of each
+// Both results are compared, so a kernel that is fast and wrong shows up as a mismatch.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <vector>
+#include <chrono>
+
+#include "rom.hpp"
+
+static void naive16(char * data, uint32_t len)
+{
+    for(uint32_t i = 0; i+2 <= len; i += 2)
+    {
+        char t = data[i];
+        data[i] = data[i+1];
+        data[i+1] = t;
+    }
+}
+
+static void naive32(char * data, uint32_t len)
+{
+    for(uint32_t i = 0; i+4 <= len; i += 4)
+    {
+        char t0 = data[i], t1 = data[i+1];
+        data[i] = data[i+3];
+        data[i+1] = data[i+2];
+        data[i+2] = t1;
+        data[i+3] = t0;
+    }
+}
+
+// best time of runs passes over a fresh copy of image, in ms; out keeps the last result
+static double best(void (*swap)(char *, uint32_t), const std::vector<char> & image, std::vector<char> & out, int runs)
+{
+    double ms = 1e30;
+    for(int r = 0; r < runs; r++)
+    {
+        out = image;
+        auto start = std::chrono::steady_clock::now();
+        swap(out.data(), out.size());
+        double t = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if(t < ms) ms = t;
+    }
+    return ms;
+}
+
+int main(int argc, char ** argv)
+{
+    uint32_t mib = argc > 1 ? atoi(argv[1]) : 64;
+    int runs = argc > 2 ? atoi(argv[2]) : 5;
+    if(mib < 1 or mib > 1024 or runs < 1) return puts("Usage: swapbench [MiB] [runs]"), 1;
+
+    std::vector<char> image(size_t(mib) << 20);
+    uint32_t x = 0x12345678;
+    for(auto & c : image)
+    {
+        x ^= x << 13, x ^= x >> 17, x ^= x << 5;
+        c = char(x);
+    }
+
+    struct { const char * name; void (*naive)(char *, uint32_t); void (*kernel)(char *, uint32_t); } cases[] = {
+        {"v64 (16-bit)", naive16, rom_swap16},
+        {"n64 (32-bit)", naive32, rom_swap32},
+    };
+    std::vector<char> a, b;
+    bool ok = true;
+    for(auto & c : cases)
+    {
+        double slow = best(c.naive, image, a, runs);
+        double fast = best(c.kernel, image, b, runs);
+        bool same = a == b;
+        ok = ok and same;
+        printf("%s: per-byte %.2f ms (%.0f MiB/s), kernel %.2f ms (%.0f MiB/s), %.1fx%s\n", c.name,
+            slow, mib / (slow / 1000), fast, mib / (fast / 1000), slow / fast, same ? "" : ", MISMATCH");
+    }
+    return ok ? 0 : 1;
+}
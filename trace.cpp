@@ -0,0 +1,161 @@
+#include "trace.hpp"
+
+#include <string.h>
+#include <vector>
+
+#include <SDL2/SDL.h>
+
+#include "coreapi.h"
+
+#define XM(X) extern ptr_##X X;
+COREAPI
+#undef XM
+
+// full blocks allowed to wait for the writer before emulation does
+#define TRACE_QUEUE 8
+
+tracer_stats tracestats;
+
+static struct {
+    tracer_config config;
+    tracewriter out;
+    tracebuilder building;
+    std::vector<tracebuilder> queue; // full blocks for the writer
+    SDL_Thread * thread = nullptr;
+    SDL_sem * wake;
+    SDL_sem * room; // counts free queue places
+    SDL_mutex * lock = nullptr; // guards queue
+    SDL_mutex * step_lock = nullptr; // keeps tracer_step out while tracing starts or stops
+    std::atomic<bool> active{false};
+    std::atomic<bool> running{false};
+    const int64_t * regs;
+    const int64_t * hi;
+    const int64_t * lo;
+    int64_t before[TRACE_REGS]; // registers at the previous step
+    bool pending; // pending_pc ran since the previous step; its writes are known now
+    uint32_t pending_pc;
+    uint64_t number; // instructions recorded
+} tracer;
+
+static int tracer_thread(void *)
+{
+    std::vector<tracebuilder> blocks;
+    while(1)
+    {
+        SDL_SemWait(tracer.wake);
+        bool stopping = !tracer.running;
+        SDL_LockMutex(tracer.lock);
+        blocks.swap(tracer.queue);
+        SDL_UnlockMutex(tracer.lock);
+        for(auto & b : blocks)
+        {
+            if(tracer.out.write(b, tracer.config.level)) tracestats.blocks++;
+            tracestats.raw_bytes = tracer.out.raw_bytes;
+            tracestats.bytes = tracer.out.offset;
+            SDL_SemPost(tracer.room);
+        }
+        blocks.clear();
+        if(stopping) break;
+    }
+    tracer.out.close();
+    return 0;
+}
+
+// hands the block being built to the writer; step_lock held
+static void queue_block()
+{
+    SDL_SemWait(tracer.room);
+    SDL_LockMutex(tracer.lock);
+    tracer.queue.push_back(std::move(tracer.building));
+    SDL_UnlockMutex(tracer.lock);
+    SDL_SemPost(tracer.wake);
+    tracer.building = tracebuilder();
+    tracer.building.data.reserve(size_t(tracer.config.block) * 4);
+}
+
+int tracer_start(const tracer_config & config)
+{
+    if(tracer.thread) return -1;
+    if(!tracer.lock) tracer.lock = SDL_CreateMutex();
+    if(!tracer.step_lock) tracer.step_lock = SDL_CreateMutex();
+    tracer.regs = (const int64_t *) DebugGetCPUDataPtr(M64P_CPU_REG_REG);
+    tracer.hi = (const int64_t *) DebugGetCPUDataPtr(M64P_CPU_REG_HI);
+    tracer.lo = (const int64_t *) DebugGetCPUDataPtr(M64P_CPU_REG_LO);
+    if(!tracer.regs or !tracer.hi or !tracer.lo) return -1;
+    tracer.config = config;
+    if(tracer.config.block == 0) tracer.config.block = 65536;
+    if(!tracer.out.open(config.path, tracer.config.block)) return -1;
+
+    tracestats.instructions = 0;
+    tracestats.blocks = 0;
+    tracestats.raw_bytes = 0;
+    tracestats.bytes = tracer.out.offset;
+
+    tracer.wake = SDL_CreateSemaphore(0);
+    tracer.room = SDL_CreateSemaphore(TRACE_QUEUE);
+    tracer.running = true;
+    tracer.thread = SDL_CreateThread(tracer_thread, "Tracer", nullptr);
+    if(!tracer.thread)
+    {
+        tracer.running = false;
+        tracer.out.close();
+        return -1;
+    }
+
+    SDL_LockMutex(tracer.step_lock);
+    tracer.queue.clear();
+    tracer.building = tracebuilder();
+    tracer.building.data.reserve(size_t(tracer.config.block) * 4);
+    tracer.pending = false;
+    tracer.number = 0;
+    tracer.active = true;
+    SDL_UnlockMutex(tracer.step_lock);
+    return 0;
+}
+
+void tracer_step(uint32_t pc)
+{
+    if(!tracer.active) return;
+    SDL_LockMutex(tracer.step_lock);
+    if(tracer.active)
+    {
+        int64_t now[TRACE_REGS];
+        memcpy(now, tracer.regs, 32 * sizeof(int64_t));
+        now[TRACE_HI] = *tracer.hi;
+        now[TRACE_LO] = *tracer.lo;
+        if(tracer.pending)
+        {
+            auto & b = tracer.building;
+            if(b.count == 0) b.begin(tracer.number, tracer.pending_pc, tracer.before);
+            b.add(tracer.pending_pc, now);
+            tracer.number++;
+            tracestats.instructions.store(tracer.number, std::memory_order_relaxed);
+            if(b.count == tracer.config.block) queue_block();
+        }
+        memcpy(tracer.before, now, sizeof(now));
+        tracer.pending_pc = pc;
+        tracer.pending = true;
+    }
+    SDL_UnlockMutex(tracer.step_lock);
+}
+
+void tracer_stop()
+{
+    if(!tracer.thread) return;
+    // the instruction at the last step hasn't run yet, so it isn't recorded
+    SDL_LockMutex(tracer.step_lock);
+    tracer.active = false;
+    if(tracer.building.count) queue_block();
+    SDL_UnlockMutex(tracer.step_lock);
+    tracer.running = false;
+    SDL_SemPost(tracer.wake);
+    SDL_WaitThread(tracer.thread, nullptr);
+    tracer.thread = nullptr;
+    SDL_DestroySemaphore(tracer.wake);
+    SDL_DestroySemaphore(tracer.room);
+}
+
+bool tracer_active()
+{
+    return tracer.active;
+}
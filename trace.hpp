@@ -0,0 +1,30 @@
+#include <stdint.h>
+#include <atomic>
+
+#include "tracefile.hpp"
+
+struct tracer_config {
+    const char * path = "trace.bac";
+    uint32_t block = 65536; // instructions per block; the most a seek has to replay
+    int level = 6; // deflate level
+};
+
+struct tracer_stats {
+    std::atomic<uint64_t> instructions{0};
+    std::atomic<uint64_t> blocks{0};
+    std::atomic<uint64_t> raw_bytes{0};
+    std::atomic<uint64_t> bytes{0};
+};
+
+// Records every executed instruction into a trace file (see tracefile.hpp). The core's debugger calls
+// back before each instruction while it is stepping; tracer_step() compares the registers with those
+// seen at the previous call, which gives the writes of the instruction before. Full blocks go to a
+// writer thread to be deflated and appended. Tracing is lossless: when the writer falls behind by
+// TRACE_QUEUE blocks, emulation waits for it.
+int tracer_start(const tracer_config & config);
+// emulation thread: the core is about to execute pc
+void tracer_step(uint32_t pc);
+// writes the last partial block and the index
+void tracer_stop();
+bool tracer_active();
+extern tracer_stats tracestats;
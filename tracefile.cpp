@@ -0,0 +1,274 @@
+#include "tracefile.hpp"
+
+#include <string.h>
+#include <algorithm>
+
+#include <zlib.h>
+
+static const char header_magic[] = "BACTRC01";
+static const char footer_magic[] = "BACTIX01";
+#define HEADER_SIZE 12
+#define BLOCK_HEADER_SIZE 24
+#define INDEX_ENTRY_SIZE 20
+#define FOOTER_SIZE 20
+#define KEYFRAME_SIZE (4 + TRACE_REGS*8)
+#define SEQUENTIAL 0x80
+
+static void put32(std::vector<uint8_t> & out, uint32_t v)
+{
+    for(int i = 0; i < 4; i++) out.push_back(v >> 8*i);
+}
+
+static void put64(std::vector<uint8_t> & out, uint64_t v)
+{
+    for(int i = 0; i < 8; i++) out.push_back(v >> 8*i);
+}
+
+static void put_signed(std::vector<uint8_t> & out, int64_t v)
+{
+    uint64_t z = uint64_t(v) << 1 ^ uint64_t(v >> 63);
+    while(z >= 0x80)
+    {
+        out.push_back(z | 0x80);
+        z >>= 7;
+    }
+    out.push_back(z);
+}
+
+static uint32_t get32(const uint8_t * p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | uint32_t(p[3]) << 24;
+}
+
+static uint64_t get64(const uint8_t * p)
+{
+    return get32(p) | uint64_t(get32(p+4)) << 32;
+}
+
+// false if the varint runs past end
+static bool get_signed(const uint8_t * & p, const uint8_t * end, int64_t & v)
+{
+    uint64_t z = 0;
+    for(int s = 0; s < 64; s += 7)
+    {
+        if(p == end) return false;
+        uint8_t b = *p++;
+        z |= uint64_t(b & 0x7F) << s;
+        if(!(b & 0x80))
+        {
+            v = int64_t(z >> 1) ^ -int64_t(z & 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+void tracebuilder::begin(uint64_t first, uint32_t pc, const int64_t * regs)
+{
+    data.clear();
+    this->first = first;
+    count = 0;
+    put32(data, pc);
+    for(int r = 0; r < TRACE_REGS; r++)
+    {
+        this->regs[r] = regs[r];
+        put64(data, regs[r]);
+    }
+    // so the first record reads as sequential
+    last_pc = pc - 4;
+}
+
+void tracebuilder::add(uint32_t pc, const int64_t * after)
+{
+    size_t head = data.size();
+    data.push_back(0);
+    uint8_t flags = 0;
+    if(pc == last_pc + 4) flags = SEQUENTIAL;
+    else put_signed(data, int32_t(pc - last_pc));
+    last_pc = pc;
+    for(int r = 0; r < TRACE_REGS; r++)
+    {
+        if(after[r] == regs[r]) continue;
+        data.push_back(r);
+        put_signed(data, int64_t(uint64_t(after[r]) - uint64_t(regs[r])));
+        regs[r] = after[r];
+        flags++;
+    }
+    data[head] = flags;
+    count++;
+}
+
+bool tracewriter::open(const char * path, uint32_t block_size)
+{
+    file = fopen(path, "wb");
+    if(!file) return false;
+    index.clear();
+    raw_bytes = 0;
+    std::vector<uint8_t> header(header_magic, header_magic + 8);
+    put32(header, block_size);
+    offset = fwrite(header.data(), 1, header.size(), file);
+    return offset == header.size();
+}
+
+bool tracewriter::write(const tracebuilder & block, int level)
+{
+    if(!file or block.count == 0) return false;
+    std::vector<uint8_t> out;
+    put32(out, TRACE_BLOCK);
+    put64(out, block.first);
+    put32(out, block.count);
+    put32(out, block.data.size());
+    uLongf size = compressBound(block.data.size());
+    out.resize(BLOCK_HEADER_SIZE + size);
+    if(compress2(out.data() + BLOCK_HEADER_SIZE, &size, block.data.data(), block.data.size(), level) != Z_OK) return false;
+    for(int i = 0; i < 4; i++) out[20 + i] = size >> 8*i;
+    out.resize(BLOCK_HEADER_SIZE + size);
+    if(fwrite(out.data(), 1, out.size(), file) != out.size()) return false;
+    // as with recordings, the block headers alone are enough to find every block again
+    fflush(file);
+    index.push_back({offset, block.first, block.count});
+    offset += out.size();
+    raw_bytes += block.data.size();
+    return true;
+}
+
+void tracewriter::close()
+{
+    if(!file) return;
+    std::vector<uint8_t> tail;
+    for(auto & b : index)
+    {
+        put64(tail, b.offset);
+        put64(tail, b.first);
+        put32(tail, b.count);
+    }
+    put64(tail, offset);
+    put32(tail, index.size());
+    tail.insert(tail.end(), footer_magic, footer_magic + 8);
+    fwrite(tail.data(), 1, tail.size(), file);
+    fclose(file);
+    file = nullptr;
+}
+
+bool tracereader::open(const char * path)
+{
+    file = fopen(path, "rb");
+    if(!file) return false;
+    uint8_t buf[HEADER_SIZE];
+    if(fread(buf, 1, HEADER_SIZE, file) != HEADER_SIZE or memcmp(buf, header_magic, 8) != 0) return close(), false;
+    block_size = get32(buf+8);
+    data.clear();
+    block = 0;
+    at = 0;
+
+    index.clear();
+    uint8_t footer[FOOTER_SIZE];
+    if(fseek(file, -FOOTER_SIZE, SEEK_END) == 0 and fread(footer, 1, FOOTER_SIZE, file) == FOOTER_SIZE
+       and memcmp(footer+12, footer_magic, 8) == 0)
+    {
+        uint64_t at = get64(footer);
+        uint32_t blocks = get32(footer+8);
+        std::vector<uint8_t> raw(size_t(blocks)*INDEX_ENTRY_SIZE);
+        fseek(file, at, SEEK_SET);
+        if(fread(raw.data(), 1, raw.size(), file) == raw.size())
+        {
+            for(uint32_t i = 0; i < blocks; i++)
+            {
+                auto p = &raw[size_t(i)*INDEX_ENTRY_SIZE];
+                index.push_back({get64(p), get64(p+8), get32(p+16)});
+            }
+            return true;
+        }
+    }
+
+    // no footer: walk the block headers, dropping one cut off mid-write
+    uint64_t at = HEADER_SIZE;
+    uint8_t head[BLOCK_HEADER_SIZE];
+    fseek(file, 0, SEEK_END);
+    uint64_t end = ftell(file);
+    while(fseek(file, at, SEEK_SET) == 0 and fread(head, 1, BLOCK_HEADER_SIZE, file) == BLOCK_HEADER_SIZE)
+    {
+        if(get32(head) != TRACE_BLOCK) break;
+        uint64_t next = at + BLOCK_HEADER_SIZE + get32(head+20);
+        if(next > end) break;
+        index.push_back({at, get64(head+4), get32(head+12)});
+        at = next;
+    }
+    return true;
+}
+
+uint64_t tracereader::instructions()
+{
+    return index.empty() ? 0 : index.back().first + index.back().count;
+}
+
+size_t tracereader::find(uint64_t n)
+{
+    return std::partition_point(index.begin(), index.end(), [&](const traceblock & b) { return b.first + b.count <= n; }) - index.begin();
+}
+
+bool tracereader::load(size_t block)
+{
+    if(block >= index.size()) return false;
+    uint8_t head[BLOCK_HEADER_SIZE];
+    if(fseek(file, index[block].offset, SEEK_SET) != 0 or fread(head, 1, BLOCK_HEADER_SIZE, file) != BLOCK_HEADER_SIZE
+       or get32(head) != TRACE_BLOCK)
+        return false;
+    std::vector<uint8_t> packed(get32(head+20));
+    if(fread(packed.data(), 1, packed.size(), file) != packed.size()) return false;
+    data.resize(get32(head+16));
+    uLongf got = data.size();
+    if(data.size() < KEYFRAME_SIZE or uncompress(data.data(), &got, packed.data(), packed.size()) != Z_OK or got != data.size())
+        return data.clear(), false;
+    this->block = block;
+    number = index[block].first;
+    last_pc = get32(data.data()) - 4;
+    for(int r = 0; r < TRACE_REGS; r++)
+        regs[r] = get64(&data[4 + r*8]);
+    at = KEYFRAME_SIZE;
+    return true;
+}
+
+bool tracereader::seek(uint64_t n)
+{
+    size_t b = find(n);
+    if(!load(b)) return false;
+    tracerecord skip;
+    while(number < n)
+        if(!next(skip)) return false;
+    return true;
+}
+
+bool tracereader::next(tracerecord & out)
+{
+    if(data.empty()) return false;
+    if(number == index[block].first + index[block].count)
+        if(!load(block + 1)) return false;
+    const uint8_t * p = data.data() + at, * end = data.data() + data.size();
+    if(p == end) return false;
+    uint8_t flags = *p++;
+    int64_t v;
+    if(flags & SEQUENTIAL) last_pc += 4;
+    else if(get_signed(p, end, v)) last_pc += uint32_t(v);
+    else return false;
+    out.index = number;
+    out.pc = last_pc;
+    out.writes = flags & 0x3F;
+    if(out.writes > TRACE_REGS) return false;
+    for(int i = 0; i < out.writes; i++)
+    {
+        if(p == end or *p >= TRACE_REGS) return false;
+        int r = out.reg[i] = *p++;
+        if(!get_signed(p, end, v)) return false;
+        regs[r] = int64_t(uint64_t(regs[r]) + uint64_t(v));
+    }
+    at = p - data.data();
+    number++;
+    return true;
+}
+
+void tracereader::close()
+{
+    if(file) fclose(file);
+    file = nullptr;
+}
@@ -0,0 +1,89 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+// Instruction trace file.
+//   header: "BACTRC01", u32 instructions per block
+//   blocks: u32 TRACE_BLOCK, u64 first instruction, u32 instructions, u32 raw size, u32 packed size,
+//           then the deflated block
+//   index:  per block: u64 file offset, u64 first instruction, u32 instructions
+//   footer: u64 index offset, u32 block count, "BACTIX01"
+// All integers are little-endian. A block inflates to a keyframe, the PC of its first instruction and
+// all TRACE_REGS registers as they were before it ran (u32, then u64 each), followed by one record per
+// instruction:
+//   byte: bit 7 set when the PC is the previous one plus 4, bits 0-5 the number of register writes
+//   zigzag varint PC difference from the previous one, when bit 7 is clear
+//   per write: register number byte, zigzag varint of the new value minus the old
+// Straight-line code costs one or two bytes per instruction before deflate. Every block starts from
+// its own keyframe, so a reader seeks to an instruction by binary searching the index and replaying
+// at most one block. A file whose writer died has no index; readers rebuild it from the block headers.
+
+#define TRACE_BLOCK 0x31435254 // "TRC1"
+#define TRACE_REGS 34 // r0-r31, hi, lo
+#define TRACE_HI 32
+#define TRACE_LO 33
+
+struct traceblock {
+    uint64_t offset;
+    uint64_t first; // number of the block's first instruction
+    uint32_t count;
+};
+
+// Builds blocks in memory. The caller feeds instructions in order and hands full blocks to a
+// tracewriter, possibly on another thread.
+struct tracebuilder {
+    std::vector<uint8_t> data; // raw block being built
+    uint64_t first = 0; // instruction number of the block's first record
+    uint32_t count = 0;
+    uint32_t last_pc = 0;
+    int64_t regs[TRACE_REGS]; // state after the last record
+
+    // starts a block whose first instruction is number first, with regs as they were before it
+    void begin(uint64_t first, uint32_t pc, const int64_t * regs);
+    // appends one instruction; after holds the registers once it ran
+    void add(uint32_t pc, const int64_t * after);
+};
+
+struct tracewriter {
+    FILE * file = nullptr;
+    std::vector<traceblock> index;
+    uint64_t offset = 0;
+    uint64_t raw_bytes = 0;
+
+    bool open(const char * path, uint32_t block_size);
+    bool write(const tracebuilder & block, int level);
+    // writes the index and footer
+    void close();
+};
+
+struct tracerecord {
+    uint64_t index;
+    uint32_t pc;
+    int writes;
+    uint8_t reg[TRACE_REGS]; // registers written, in order
+};
+
+struct tracereader {
+    FILE * file = nullptr;
+    uint32_t block_size = 0;
+    std::vector<traceblock> index;
+    int64_t regs[TRACE_REGS]; // registers after the record last returned by next()
+
+    bool open(const char * path);
+    uint64_t instructions();
+    // block holding instruction n; index.size() if none
+    size_t find(uint64_t n);
+    // positions the reader so that next() returns instruction n
+    bool seek(uint64_t n);
+    // the following instruction and the registers it wrote; false at the end or on a damaged block
+    bool next(tracerecord & out);
+    void close();
+
+    // inflated current block and the read position in it
+    std::vector<uint8_t> data;
+    size_t block = 0;
+    size_t at = 0;
+    uint64_t number = 0; // instruction next() returns
+    uint32_t last_pc = 0;
+    bool load(size_t block);
+};
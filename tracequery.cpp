@@ -0,0 +1,62 @@
+// tracequery: reads an instruction trace written by bacui's tracer.
+//   tracequery <file>                        lists the blocks
+//   tracequery <file> <first> [count]        prints count (default 20) instructions from number first,
+//                                            each with the registers it wrote
+//   tracequery <file> <n> regs               prints every register as it was before instruction n
+// Seeking binary searches the block index and replays one block at most.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tracefile.hpp"
+
+static const char * register_names[TRACE_REGS] = {
+    "r0", "at", "v0", "v1", "a0", "a1", "a2", "a3",
+    "t0", "t1", "t2", "t3", "t4", "t5", "t6", "t7",
+    "s0", "s1", "s2", "s3", "s4", "s5", "s6", "s7",
+    "t8", "t9", "k0", "k1", "gp", "sp", "s8", "ra",
+    "hi", "lo"
+};
+
+int main(int argc, char ** argv)
+{
+    if(argc < 2) return puts("Usage: tracequery <file> [<first> [count|regs]]"), 1;
+    tracereader file;
+    if(!file.open(argv[1])) return printf("Can't read %s as a trace.\n", argv[1]), 1;
+
+    if(argc < 3)
+    {
+        printf("%llu instructions in %zu blocks of up to %u\n", (unsigned long long)file.instructions(),
+            file.index.size(), file.block_size);
+        for(size_t b = 0; b < file.index.size(); b++)
+            printf("%5zu %12llu %8u @%llu\n", b, (unsigned long long)file.index[b].first, file.index[b].count,
+                (unsigned long long)file.index[b].offset);
+        return 0;
+    }
+
+    uint64_t first = strtoull(argv[2], nullptr, 0);
+    if(first >= file.instructions()) return printf("The trace has %llu instructions.\n", (unsigned long long)file.instructions()), 1;
+    if(!file.seek(first)) return printf("Block %zu is damaged.\n", file.find(first)), 1;
+
+    if(argc > 3 and strcmp(argv[3], "regs") == 0)
+    {
+        for(int r = 0; r < TRACE_REGS; r++)
+            printf("%s\t%016llX\n", register_names[r], (unsigned long long)file.regs[r]);
+        return 0;
+    }
+
+    uint64_t count = argc > 3 ? strtoull(argv[3], nullptr, 0) : 20;
+    tracerecord record;
+    for(uint64_t i = 0; i < count and file.next(record); i++)
+    {
+        printf("%llu\t%08X", (unsigned long long)record.index, record.pc);
+        for(int w = 0; w < record.writes; w++)
+        {
+            int r = record.reg[w];
+            printf("\t%s=%llX", register_names[r], (unsigned long long)file.regs[r]);
+        }
+        puts("");
+    }
+    return 0;
+}
@@ -0,0 +1,73 @@
+#include "wake.hpp"
+
+#include <atomic>
+
+#include <SDL2/SDL.h>
+
+#ifndef _WIN32
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif //  _WIN32
+
+static std::atomic<bool> pending{false};
+
+#ifndef _WIN32
+
+static int wake_pipe[2] = {-1, -1};
+
+int ui_wake_init()
+{
+    if(pipe(wake_pipe) != 0) return -1;
+    fcntl(wake_pipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(wake_pipe[1], F_SETFL, O_NONBLOCK);
+    return 0;
+}
+
+void ui_wake()
+{
+    if(pending.exchange(true)) return;
+    char byte = 0;
+    if(write(wake_pipe[1], &byte, 1) < 0) { } // a full pipe already means "wake up"
+}
+
+bool ui_wait(int fd, int timeout_ms)
+{
+    struct pollfd fds[2] = {{wake_pipe[0], POLLIN, 0}, {fd, POLLIN, 0}};
+    poll(fds, 2, timeout_ms);
+    // re-arm before draining: anything published after this either writes a new byte or is
+    // already visible to the caller, which processes after we return
+    pending = false;
+    if(fds[0].revents & POLLIN)
+    {
+        char bytes[64];
+        while(read(wake_pipe[0], bytes, sizeof(bytes)) > 0);
+    }
+    return fds[1].revents & POLLIN;
+}
+
+#else  //  _WIN32
+
+// no pollable console handle here; fall back to a semaphore and let the caller poll input
+static SDL_sem * wake_sem;
+
+int ui_wake_init()
+{
+    wake_sem = SDL_CreateSemaphore(0);
+    return wake_sem ? 0 : -1;
+}
+
+void ui_wake()
+{
+    if(pending.exchange(true)) return;
+    SDL_SemPost(wake_sem);
+}
+
+bool ui_wait(int fd, int timeout_ms)
+{
+    SDL_SemWaitTimeout(wake_sem, timeout_ms < 0 or timeout_ms > 16 ? 16 : timeout_ms);
+    pending = false;
+    return true;
+}
+
+#endif //  _WIN32
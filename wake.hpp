@@ -0,0 +1,9 @@
+// Wakeup for the UI thread. Producers (frame sampler, log writer, emulation shutdown) call
+// ui_wake() from any thread; it costs one atomic exchange, plus one pipe write only when the UI
+// has consumed the previous wakeup. The UI sleeps in ui_wait() until woken, input arrives on fd,
+// or the timeout passes.
+
+int ui_wake_init();
+void ui_wake();
+// returns true if fd has input waiting
+bool ui_wait(int fd, int timeout_ms);
@@ -0,0 +1,285 @@
+#include "watch.hpp"
+#include "rdram.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <algorithm>
+
+#include "coreapi.h"
+
+#define XM(X) extern ptr_##X X;
+COREAPI
+#undef XM
+
+// spans closer than this are merged; copying a few unwatched bytes is cheaper than another span
+#define SPAN_GAP 64
+
+int watch_width(uint32_t mode)
+{
+    if(mode == char_) return 8;
+    if(mode == u8_ or mode == s8_) return 1;
+    if(mode == u16_ or mode == s16_) return 2;
+    return 4;
+}
+
+static const struct {
+    const char * name;
+    uint32_t mode;
+} watchtypes[] = {
+    {"u32", int_}, {"int", int_}, {"f32", float_}, {"float", float_}, {"char", char_},
+    {"u8", u8_}, {"u16", u16_}, {"s8", s8_}, {"s16", s16_}, {"s32", s32_}
+};
+
+// index of the link for [parent's pointer + offset], shared with any entry that already made it
+static int intern_link(std::vector<watchlink> & links, int parent, uint32_t offset)
+{
+    for(size_t i = 0; i < links.size(); i++)
+        if(links[i].parent == parent and links[i].offset == offset)
+            return i;
+    links.push_back({parent, offset});
+    return links.size()-1;
+}
+
+// address := term (('+'|'-') number)*
+// term := number | '[' address ']'
+// Numbers are hex. The result is chain's pointer + offset, or just offset when chain is -1.
+static bool parse_address(const char *& s, std::vector<watchlink> & links, int & chain, uint32_t & offset)
+{
+    while(isspace((unsigned char)*s)) s++;
+    char * end;
+    if(*s == '[')
+    {
+        s++;
+        int inner;
+        uint32_t inner_offset;
+        if(!parse_address(s, links, inner, inner_offset)) return false;
+        while(isspace((unsigned char)*s)) s++;
+        if(*s++ != ']') return false;
+        chain = intern_link(links, inner, inner_offset);
+        offset = 0;
+    }
+    else
+    {
+        offset = strtoul(s, &end, 16);
+        if(end == s) return false;
+        s = end;
+        chain = -1;
+    }
+    while(1)
+    {
+        while(isspace((unsigned char)*s)) s++;
+        if(*s != '+' and *s != '-') return true;
+        bool minus = *s++ == '-';
+        uint32_t n = strtoul(s, &end, 16);
+        if(end == s) return false;
+        s = end;
+        offset += minus ? -n : n;
+    }
+}
+
+bool watchsampler::add(const char * text)
+{
+    char type[8];
+    int used = 0;
+    if(sscanf(text, " %7s %n", type, &used) < 1) return false;
+    watchlist_entry entry;
+    entry.mode = UINT32_MAX;
+    for(auto & t : watchtypes)
+        if(strcmp(type, t.name) == 0) entry.mode = t.mode;
+    if(entry.mode == UINT32_MAX) return false;
+    
+    // links are only kept if the whole entry parses
+    auto kept = links.size();
+    const char * s = text + used;
+    if(!parse_address(s, links, entry.chain, entry.addr) or s[strspn(s, " \t")] != 0)
+    {
+        links.resize(kept);
+        return false;
+    }
+    entries.push_back(entry);
+    sources.push_back(text);
+    return true;
+}
+
+// big-endian word at an N64 address, wherever it lives
+static uint32_t fetch(const uint32_t * rdram, uint32_t addr)
+{
+    uint32_t phys = rdram_phys(addr);
+    if(rdram and phys != UINT32_MAX and phys + 4 <= RDRAM_SIZE)
+        return rdram_read(rdram, 0, phys, 4);
+    if((addr & 3) == 0) return DebugMemRead32(addr);
+    uint32_t shift = 8*(addr & 3);
+    return DebugMemRead32(addr & ~3u) << shift | DebugMemRead32((addr & ~3u) + 4) >> (32 - shift);
+}
+
+void watchsampler::build()
+{
+    pointers.assign(links.size(), 0);
+    std::vector<size_t> order;
+    for(size_t i = 0; i < entries.size(); i++)
+        if(entries[i].chain < 0 and rdram_phys(entries[i].addr) != UINT32_MAX)
+            order.push_back(i);
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return rdram_phys(entries[a].addr) < rdram_phys(entries[b].addr); });
+    
+    spans.clear();
+    span_of.assign(entries.size(), -1);
+    uint32_t words_total = 0;
+    for(auto i : order)
+    {
+        uint32_t start = rdram_phys(entries[i].addr);
+        uint32_t end = start + watch_width(entries[i].mode);
+        if(end > RDRAM_SIZE) end = RDRAM_SIZE;
+        start &= ~3u;
+        end = (end + 3) & ~3u;
+        if(!spans.empty() and start <= spans.back().end + SPAN_GAP)
+        {
+            auto & s = spans.back();
+            if(end > s.end)
+            {
+                words_total += (end - s.end) / 4;
+                s.end = end;
+            }
+        }
+        else
+        {
+            spans.push_back({start, end, words_total});
+            words_total += (end - start) / 4;
+        }
+        span_of[i] = spans.size()-1;
+    }
+    span_words = words_total;
+}
+
+uint32_t watchsampler::stride()
+{
+    return span_words + entries.size()*ENTRY_WORDS;
+}
+
+bool watchsampler::sample(uint32_t * out)
+{
+    if(!spans.empty() or !links.empty())
+    {
+        // the RDRAM block never moves once the core is running, so only ask until it exists
+        if(rdram == nullptr) rdram = (const uint32_t *) DebugMemGetPointer(M64P_DBG_PTR_RDRAM);
+        if(rdram == nullptr) return false;
+        for(auto & s : spans)
+            memcpy(out + s.first, rdram + s.start/4, s.end - s.start);
+    }
+    // parents always come before their children, so one pass dereferences every link exactly once
+    for(size_t l = 0; l < links.size(); l++)
+    {
+        auto & k = links[l];
+        if(k.parent < 0)
+            pointers[l] = fetch(rdram, k.offset);
+        else
+            pointers[l] = pointers[k.parent] ? fetch(rdram, pointers[k.parent] + k.offset) : 0;
+    }
+    for(size_t i = 0; i < entries.size(); i++)
+    {
+        auto slot = out + span_words + i*ENTRY_WORDS;
+        if(span_of[i] >= 0) continue;
+        auto & e = entries[i];
+        uint32_t addr = e.chain < 0 ? e.addr : pointers[e.chain] ? pointers[e.chain] + e.addr : 0;
+        slot[2] = addr;
+        slot[0] = addr ? fetch(rdram, addr) : 0;
+        slot[1] = addr and watch_width(e.mode) > 4 ? fetch(rdram, addr + 4) : 0;
+    }
+    return true;
+}
+
+void watchsampler::view(const uint32_t * snapshot)
+{
+    current = snapshot;
+}
+
+// big-endian value of an entry's first len bytes in a snapshot
+static uint32_t read_entry(const watchsampler & w, const uint32_t * snapshot, size_t entry, int len)
+{
+    if(w.span_of[entry] < 0)
+    {
+        auto slot = snapshot + w.span_words + entry*ENTRY_WORDS;
+        return len == 4 ? slot[0] : slot[0] >> (32 - 8*len);
+    }
+    auto & s = w.spans[w.span_of[entry]];
+    return rdram_read(snapshot + s.first, s.start, rdram_phys(w.entries[entry].addr), len);
+}
+
+uint32_t watchsampler::read(size_t entry, int len)
+{
+    if(!current) return 0;
+    return read_entry(*this, current, entry, len);
+}
+
+void watchsampler::values(const uint32_t * snapshot, uint32_t * out)
+{
+    for(size_t i = 0; i < entries.size(); i++)
+    {
+        int width = watch_width(entries[i].mode);
+        out[i] = read_entry(*this, snapshot, i, width > 4 ? 4 : width);
+    }
+}
+
+uint8_t watchsampler::byte(size_t entry, uint32_t i)
+{
+    if(!current) return 0;
+    if(span_of[entry] < 0)
+    {
+        auto slot = current + span_words + entry*ENTRY_WORDS;
+        return i < 8 ? slot[i/4] >> (24 - 8*(i%4)) : 0;
+    }
+    auto & s = spans[span_of[entry]];
+    uint32_t p = rdram_phys(entries[entry].addr) + i;
+    if(p >= s.end) return 0;
+    return rdram_byte(current + s.first, s.start, p);
+}
+
+uint32_t watchsampler::address(size_t entry)
+{
+    if(span_of[entry] >= 0) return entries[entry].addr;
+    if(!current) return entries[entry].chain < 0 ? entries[entry].addr : 0;
+    return current[span_words + entry*ENTRY_WORDS + 2];
+}
+
+void framering::init(uint32_t capacity, uint32_t stride)
+{
+    this->capacity = capacity;
+    this->stride = stride;
+    slots.assign(size_t(capacity) * stride, 0);
+    frames.assign(capacity, 0);
+    head = 0;
+    tail = 0;
+    dropped = 0;
+}
+
+uint32_t * framering::reserve()
+{
+    auto h = head.load(std::memory_order_relaxed);
+    if(h - tail.load(std::memory_order_acquire) >= capacity)
+    {
+        dropped++;
+        return nullptr;
+    }
+    return &slots[size_t(h & (capacity-1)) * stride];
+}
+
+void framering::commit(uint32_t frame)
+{
+    auto h = head.load(std::memory_order_relaxed);
+    frames[h & (capacity-1)] = frame;
+    head.store(h+1, std::memory_order_release);
+}
+
+const uint32_t * framering::peek(uint32_t * frame)
+{
+    auto t = tail.load(std::memory_order_relaxed);
+    if(t == head.load(std::memory_order_acquire)) return nullptr;
+    if(frame) *frame = frames[t & (capacity-1)];
+    return &slots[size_t(t & (capacity-1)) * stride];
+}
+
+void framering::pop()
+{
+    tail.store(tail.load(std::memory_order_relaxed)+1, std::memory_order_release);
+}
@@ -0,0 +1,105 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <string>
+#include <atomic>
+
+enum {
+    int_,
+    float_,
+    char_,
+    u8_,
+    u16_,
+    s8_,
+    s16_,
+    s32_
+};
+
+struct watchlist_entry {
+    uint32_t addr; // absolute, or an offset from the chain's pointer
+    uint32_t mode;
+    int chain = -1; // link whose pointer the address is relative to; -1 for a fixed address
+};
+
+// One dereference in a pointer chain: the word at (parent's pointer + offset), or at offset itself
+// for a chain's first link. Links are shared, so entries written against the same base chain
+// all point at the same links.
+struct watchlink {
+    int parent;
+    uint32_t offset;
+};
+
+// bytes a watch of the given mode covers
+int watch_width(uint32_t mode);
+
+// a run of RDRAM read as one copy; start and end are word-aligned physical offsets
+struct watchspan {
+    uint32_t start;
+    uint32_t end;
+    uint32_t first; // index of the span's first word in the snapshot
+};
+
+// Reads all watches from one snapshot of coalesced RDRAM spans.
+// Entries are sorted by physical address and merged when they are close together, so a sample costs
+// one copy per span instead of one core call per entry. Entries outside direct-mapped RDRAM
+// (TLB-mapped or I/O addresses) still go through DebugMemRead32.
+// Entries behind pointers ("[[0x80200000]+0x10]+0x44") are resolved at each sample: every link is
+// dereferenced once, in order, and its pointer reused by everything built on it.
+// A snapshot is a flat array of stride() words: the span words, then ENTRY_WORDS per entry holding
+// the value and address of entries that aren't in a span.
+#define ENTRY_WORDS 3
+struct watchsampler {
+    std::vector<watchlist_entry> entries;
+    std::vector<std::string> sources; // per entry, the text it was added from
+    std::vector<watchlink> links;
+    std::vector<uint32_t> pointers; // per link, for the sample in progress; 0 when the chain is broken
+    std::vector<watchspan> spans;
+    // per entry: span index, or -1 for entries that go through the core
+    std::vector<int> span_of;
+    uint32_t span_words = 0;
+    const uint32_t * rdram = nullptr;
+    // snapshot that read() and byte() decode from
+    const uint32_t * current = nullptr;
+    
+    // adds an entry from "<type> <address>", e.g. "f32 [[0x80200000]+0x10]+0x44"
+    // types: u8 u16 u32 s8 s16 s32 f32 char; false if the text doesn't parse
+    bool add(const char * text);
+    // regroups spans; call after changing entries
+    void build();
+    uint32_t stride();
+    // fills a snapshot; returns false if RDRAM isn't available yet
+    bool sample(uint32_t * out);
+    void view(const uint32_t * snapshot);
+    
+    // big-endian value of the entry's first len bytes
+    uint32_t read(size_t entry, int len = 4);
+    // read() of every entry at its own width, from any snapshot; safe off the UI thread
+    void values(const uint32_t * snapshot, uint32_t * out);
+    // where the entry was read from; 0 when a pointer on its chain was null
+    uint32_t address(size_t entry);
+    uint8_t byte(size_t entry, uint32_t i);
+};
+
+// Single-producer/single-consumer ring of per-frame snapshots. The emulation thread writes one
+// record per frame without locking or allocating; the UI thread drains them. When the UI falls
+// behind, new frames are dropped and counted rather than waited on.
+struct framering {
+    uint32_t capacity = 0; // power of two
+    uint32_t stride = 0;
+    std::vector<uint32_t> slots;
+    std::vector<uint32_t> frames;
+    std::atomic<uint32_t> head{0}; // next record to write, owned by the producer
+    std::atomic<uint32_t> tail{0}; // next record to read, owned by the consumer
+    std::atomic<uint32_t> dropped{0};
+    
+    // not thread safe; call while neither side is running
+    void init(uint32_t capacity, uint32_t stride);
+    
+    // producer: nullptr when full
+    uint32_t * reserve();
+    void commit(uint32_t frame);
+    
+    // consumer: oldest unread record, or nullptr when empty
+    const uint32_t * peek(uint32_t * frame = nullptr);
+    void pop();
+};